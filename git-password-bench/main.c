@@ -0,0 +1,588 @@
+//
+//  main.c
+//  git-password-bench
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+#define BENCH_DEFAULT_ITERATIONS 1000
+#define BENCH_KEYCHAIN_PASSWORD "git-password-bench"
+#define BENCH_USERNAME "bench"
+#define BENCH_PASSWORD "secret"
+#define BENCH_STRESS_ITERATIONS 100
+
+struct Phase
+{
+	const char * name;
+	double * samples;
+	int count;
+};
+typedef struct Phase Phase;
+
+static FILE * terminal;
+static char * scratch;
+#if GIT_PASSWORD_WITH_KEYCHAIN
+static SecKeychainRef keychain;
+#endif
+
+static int compare_samples(const void * a, const void * b)
+{
+	double left = *(const double *)a, right = *(const double *)b;
+
+	return (left > right) - (left < right);
+}
+
+static void report(Phase * phase)
+{
+	double total = 0;
+
+	for (int i = 0; i < phase->count; i++)
+		total += phase->samples[i];
+
+	qsort(phase->samples, phase->count, sizeof(double), compare_samples);
+	printf("%-22s %10d %12.1f %12.1f %12.1f\n", phase->name, phase->count,
+		phase->samples[phase->count / 2] * 1e6,
+		phase->samples[phase->count * 99 / 100] * 1e6,
+		total > 0 ? phase->count / total : 0);
+
+	free(phase->samples);
+}
+
+static void measure(const char * name, int iterations, void (* body)(int))
+{
+	Phase phase = { name, calloc(iterations, sizeof(double)), iterations };
+
+	if (!phase.samples)
+		fatal("unable to allocate memory", terminal);
+
+	for (int i = 0; i < iterations; i++)
+	{
+		double started = now_seconds();
+
+		body(i);
+		phase.samples[i] = now_seconds() - started;
+	}
+
+	report(&phase);
+}
+
+static char * bench_repository(int i)
+{
+	static char repository[64];
+
+	snprintf(repository, sizeof(repository), "https://bench-%d.example.com/", i);
+
+	return repository;
+}
+
+static void bench_ancestry(int i)
+{
+	is_git_calling_us(terminal);
+}
+
+static void bench_parse_prompt(int i)
+{
+	Prompt request;
+
+	parse_prompt("Password for 'https://bench@example.com/org/repo.git': ", &request, terminal);
+	arena_reset();
+}
+
+static void bench_canonical_repository(int i)
+{
+	canonical_repository("https://bench@Example.com:443/org/repo.git", terminal);
+	arena_reset();
+}
+
+static void bench_git_config(int i)
+{
+	git_config("remote.origin.url", terminal);
+	arena_reset();
+}
+
+#if GIT_PASSWORD_WITH_KEYCHAIN
+static void bench_create_keychain_item(int i)
+{
+	create_keychain_item(bench_repository(i), BENCH_USERNAME, BENCH_PASSWORD, 0, terminal);
+}
+
+static void bench_find_keychain_item(int i)
+{
+	free_keychain_item(find_keychain_item(bench_repository(i), true, terminal));
+}
+
+static void bench_delete_keychain_item(int i)
+{
+	delete_keychain_item(bench_repository(i), NULL, terminal);
+}
+#endif
+
+// A chain with only the in-memory backend, so the lookup path is timed without any
+// store behind it.
+static Backend * bench_memory(void)
+{
+	static Backend * backend = NULL;
+	Backend * memory;
+
+	if (!backend && ((memory = memory_backend()) == NULL || (backend = chain_backend(&memory, 1)) == NULL))
+		fatal("unable to allocate memory", terminal);
+
+	return backend;
+}
+
+static void bench_memory_store(int i)
+{
+	bench_memory()->store(bench_memory(), bench_repository(i % 64), BENCH_USERNAME, BENCH_PASSWORD, 0, terminal);
+}
+
+static void bench_memory_lookup(int i)
+{
+	KeyChainItem * item;
+
+	if (bench_memory()->lookup(bench_memory(), bench_repository(i % 64), true, &item, terminal) == errSecSuccess)
+		free_keychain_item(item);
+}
+
+static void run(const char * command)
+{
+	if (system(command) != 0)
+		fatal(command, terminal);
+}
+
+// Everything the bench touches lives under one temporary directory: a git
+// repository for the config lookups and a keychain the tool is pointed at.
+static void setup(void)
+{
+	char template[] = "/tmp/git-password-bench.XXXXXX";
+	char * command, * path;
+
+	if ((scratch = strdup(mkdtemp(template))) == NULL)
+		fatal("unable to create scratch directory", terminal);
+
+	if (asprintf(&command, "git init -q '%s/repo' && git -C '%s/repo' config remote.origin.url https://example.com/org/repo.git", scratch, scratch) < 0)
+		fatal("unable to allocate memory", terminal);
+	run(command);
+	free(command);
+
+	if (asprintf(&path, "%s/repo", scratch) < 0 || chdir(path) != 0)
+		fatal("unable to enter scratch repository", terminal);
+	free(path);
+
+#if GIT_PASSWORD_WITH_KEYCHAIN
+	if (asprintf(&path, "%s/bench.keychain", scratch) < 0)
+		fatal("unable to allocate memory", terminal);
+	if (!security_api())
+		security(errSecNotAvailable, terminal);
+	security(security_api()->SecKeychainCreate(path, len(BENCH_KEYCHAIN_PASSWORD), BENCH_KEYCHAIN_PASSWORD, false, NULL, &keychain), terminal);
+	setenv("GIT_PASSWORD_KEYCHAIN", path, 1);
+	free(path);
+#endif
+}
+
+static void teardown(void)
+{
+	char * command;
+
+#if GIT_PASSWORD_WITH_KEYCHAIN
+	security_api()->SecKeychainDelete(keychain);
+	security_api()->CFRelease(keychain);
+#endif
+
+	if (asprintf(&command, "rm -rf '%s'", scratch) >= 0)
+		system(command);
+	free(command);
+}
+
+#if GIT_PASSWORD_WITH_KEYCHAIN
+// A minimal dumb-HTTP remote: 401 until the client authenticates, then a single ref.
+static void serve_fixture(int listener)
+{
+	char request[4096];
+	const char * body, * status;
+
+	for (;;)
+	{
+		int client = accept(listener, NULL, NULL);
+		ssize_t length;
+
+		if (client < 0)
+			continue;
+
+		length = read(client, request, sizeof(request) - 1);
+		request[length > 0 ? length : 0] = 0;
+
+		if (strstr(request, "\r\nAuthorization:") == NULL)
+		{
+			status = "401 Unauthorized\r\nWWW-Authenticate: Basic realm=\"git-password-bench\"";
+			body = "";
+		}
+		else if (strstr(request, "/info/refs"))
+		{
+			status = "200 OK";
+			body = "0123456789abcdef0123456789abcdef01234567\trefs/heads/master\n";
+		}
+		else if (strstr(request, "/HEAD "))
+		{
+			status = "200 OK";
+			body = "ref: refs/heads/master\n";
+		}
+		else
+		{
+			status = "404 Not Found";
+			body = "";
+		}
+
+		dprintf(client, "HTTP/1.1 %s\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s", status, strlen(body), body);
+		close(client);
+	}
+}
+
+static pid_t start_fixture(int * port)
+{
+	struct sockaddr_in address = { 0 };
+	socklen_t size = sizeof(address);
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	pid_t pid;
+
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+		fatal("unable to start HTTP fixture", terminal);
+	if (getsockname(listener, (struct sockaddr *)&address, &size) != 0)
+		fatal("unable to start HTTP fixture", terminal);
+
+	*port = ntohs(address.sin_port);
+
+	if ((pid = fork()) == 0)
+		serve_fixture(listener);
+
+	close(listener);
+
+	return pid;
+}
+
+static char * ls_remote_url;
+
+static void bench_ls_remote(int i)
+{
+	char * command;
+
+	if (asprintf(&command, "git -c credential.helper= ls-remote '%s' >/dev/null", ls_remote_url) < 0)
+		fatal("unable to allocate memory", terminal);
+	run(command);
+	free(command);
+}
+
+static void end_to_end(const char * askpass, int iterations)
+{
+	char repository[64];
+	int port;
+	pid_t fixture = start_fixture(&port);
+
+	snprintf(repository, sizeof(repository), "http://127.0.0.1:%d/", port);
+	create_keychain_item(repository, BENCH_USERNAME, BENCH_PASSWORD, 0, terminal);
+
+	if (asprintf(&ls_remote_url, "%srepo.git", repository) < 0)
+		fatal("unable to allocate memory", terminal);
+	setenv("GIT_ASKPASS", askpass, 1);
+	setenv("GIT_TERMINAL_PROMPT", "0", 1);
+
+	measure("git ls-remote", iterations, bench_ls_remote);
+
+	kill(fixture, SIGTERM);
+	waitpid(fixture, NULL, 0);
+	free(ls_remote_url);
+}
+#endif
+
+#if GIT_PASSWORD_WITH_ANCESTRY
+// A generated process table of count entries with pids 2 to count + 1 in
+// shuffled order. Every process is a child of launchd except the chain that
+// starts at pid 2 and runs through depth processes, the last of them git.
+struct SyntheticTable
+{
+	struct kinfo_proc * processes;
+	size_t * slots;
+	size_t count;
+};
+typedef struct SyntheticTable SyntheticTable;
+
+struct StressVariant
+{
+	const char * name;
+	int (* run)(void);
+};
+typedef struct StressVariant StressVariant;
+
+static SyntheticTable stress_table;
+
+// Lookups by pid are constant time, as in the kernel; what a real sysctl costs
+// per hop is what the is_git_calling_us phase of the ordinary run shows.
+static bool synthetic_lookup(ProcessSource * self, pid_t pid, struct kinfo_proc * info)
+{
+	SyntheticTable * table = self->state;
+
+	if (pid < 2 || (size_t)pid > table->count + 1)
+		return false;
+	*info = table->processes[table->slots[pid]];
+
+	return true;
+}
+
+static bool synthetic_snapshot(ProcessSource * self, struct kinfo_proc ** processes, size_t * count)
+{
+	SyntheticTable * table = self->state;
+
+	if ((*processes = malloc(table->count * sizeof(struct kinfo_proc))) == NULL)
+		return false;
+	memcpy(*processes, table->processes, table->count * sizeof(struct kinfo_proc));
+	*count = table->count;
+
+	return true;
+}
+
+static ProcessSource stress_source = { synthetic_lookup, synthetic_snapshot, &stress_table };
+
+// The start time is unique to this run, so the cached variant never finds a
+// verdict another cell left behind.
+static void synthetic_table(SyntheticTable * table, size_t count, size_t depth)
+{
+	pid_t * pids = malloc(count * sizeof(pid_t));
+
+	table->processes = calloc(count, sizeof(struct kinfo_proc));
+	table->slots = calloc(count + 2, sizeof(size_t));
+	table->count = count;
+	if (!pids || !table->processes || !table->slots)
+		fatal("unable to allocate memory", terminal);
+
+	for (size_t i = 0; i < count; i++)
+		pids[i] = (pid_t)(i + 2);
+	for (size_t i = count - 1; i > 0; i--)
+	{
+		size_t j = (size_t)random() % (i + 1);
+		pid_t swap = pids[i];
+
+		pids[i] = pids[j];
+		pids[j] = swap;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		struct kinfo_proc * process = &table->processes[i];
+		pid_t pid = pids[i];
+
+		process->kp_proc.p_pid = pid;
+		process->kp_proc.p_starttime.tv_sec = time(NULL);
+		process->kp_proc.p_starttime.tv_usec = getpid() % 1000000;
+		process->kp_eproc.e_ppid = (size_t)pid < depth + 1 ? pid + 1 : 1;
+		strlcpy(process->kp_proc.p_comm, (size_t)pid == depth + 1 ? "git" : (size_t)pid < depth + 1 ? "sh" : "worker", sizeof(process->kp_proc.p_comm));
+		table->slots[pid] = i;
+	}
+
+	free(pids);
+}
+
+static int stress_scan(void)
+{
+	return ancestry_scan(&stress_source, 2);
+}
+
+static int stress_walk(void)
+{
+	return ancestry_check(&stress_source, 2, 0, terminal);
+}
+
+static int stress_cached(void)
+{
+	int found = ancestry_check(&stress_source, 2, 3600, terminal);
+
+	arena_reset();
+
+	return found;
+}
+
+// Each cell runs in a child of its own, so its peak resident size is what that
+// variant needed on top of the table; ru_maxrss is in bytes on macOS.
+static void stress_cell(const StressVariant * variant, size_t entries, size_t depth, int iterations)
+{
+	Phase phase = { variant->name, NULL, iterations };
+	struct rusage before, after;
+	pid_t child;
+	int found;
+
+	fflush(stdout);
+	if ((child = fork()) != 0)
+	{
+		if (child < 0 || waitpid(child, NULL, 0) < 0)
+			fatal("unable to run stress cell", terminal);
+		return;
+	}
+
+	synthetic_table(&stress_table, entries, depth);
+	if ((phase.samples = calloc(iterations, sizeof(double))) == NULL)
+		fatal("unable to allocate memory", terminal);
+	getrusage(RUSAGE_SELF, &before);
+
+	found = variant->run();
+	for (int i = 0; i < iterations; i++)
+	{
+		double started = now_seconds();
+
+		variant->run();
+		phase.samples[i] = now_seconds() - started;
+	}
+	getrusage(RUSAGE_SELF, &after);
+
+	qsort(phase.samples, phase.count, sizeof(double), compare_samples);
+	printf("%-10s %10zu %6zu %5s %12.1f %12.1f %12ld\n", phase.name, entries, depth, found ? "yes" : "no",
+		phase.samples[phase.count / 2] * 1e6, phase.samples[phase.count * 99 / 100] * 1e6, (long)(after.ru_maxrss - before.ru_maxrss) / 1024);
+	fflush(stdout);
+	_exit(0);
+}
+
+static size_t parse_sizes(const char * list, size_t * sizes, size_t capacity)
+{
+	size_t count = 0;
+	char * end;
+
+	while (*list && count < capacity)
+	{
+		if ((sizes[count++] = strtoul(list, &end, 10)) == 0 || (*end && *end != ','))
+			return 0;
+		list = *end ? end + 1 : end;
+	}
+
+	return count;
+}
+
+// The current PID walk, the same walk answered from the ancestry cache, and the
+// full-table scan it replaced, over generated tables of every size and depth.
+// The walk gives up after ANCESTRY_MAX_HOPS, so deeper chains show "no".
+static void ancestry_stress(int iterations, const char * entries_list, const char * depths_list)
+{
+	static const StressVariant variants[] = { { "scan", stress_scan }, { "pid-walk", stress_walk }, { "cached", stress_cached } };
+	size_t entries[16] = { 1000, 10000, 100000 }, depths[16] = { 1, 10, 50 };
+	size_t entry_count = 3, depth_count = 3;
+
+	if (entries_list && (entry_count = parse_sizes(entries_list, entries, 16)) == 0)
+		fatal("--entries takes a comma-separated list of table sizes", terminal);
+	if (depths_list && (depth_count = parse_sizes(depths_list, depths, 16)) == 0)
+		fatal("--depths takes a comma-separated list of chain depths", terminal);
+
+	printf("%-10s %10s %6s %5s %12s %12s %12s\n", "variant", "entries", "depth", "git", "p50 (us)", "p99 (us)", "peak (KiB)");
+	for (size_t e = 0; e < entry_count; e++)
+		for (size_t d = 0; d < depth_count; d++)
+		{
+			if (depths[d] > entries[e])
+				continue;
+			for (size_t v = 0; v < sizeof(variants) / sizeof(*variants); v++)
+				stress_cell(&variants[v], entries[e], depths[d], iterations);
+		}
+}
+#endif
+
+static void usage(void)
+{
+	fatal("usage: git-password-bench [-n <iterations>] [--ls-remote <path to git-password>] | [-n <iterations>] --ancestry-stress [--entries <n,...>] [--depths <n,...>]", terminal);
+}
+
+int main(int argc, const char * argv[])
+{
+	int iterations = 0;
+	const char * askpass = NULL, * entries = NULL, * depths = NULL;
+	bool stress = false;
+
+	terminal = stderr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+		{
+			if ((iterations = atoi(argv[++i])) <= 0)
+				usage();
+		}
+		else if (strcmp(argv[i], "--ls-remote") == 0 && i + 1 < argc)
+			askpass = argv[++i];
+		else if (strcmp(argv[i], "--ancestry-stress") == 0)
+			stress = true;
+		else if (strcmp(argv[i], "--entries") == 0 && i + 1 < argc)
+			entries = argv[++i];
+		else if (strcmp(argv[i], "--depths") == 0 && i + 1 < argc)
+			depths = argv[++i];
+		else
+			usage();
+	}
+	if ((!stress && (entries || depths)) || (stress && askpass))
+		usage();
+
+	if (stress)
+	{
+#if GIT_PASSWORD_WITH_ANCESTRY
+		ancestry_stress(iterations ? iterations : BENCH_STRESS_ITERATIONS, entries, depths);
+		return 0;
+#else
+		fatal("--ancestry-stress needs the ancestry check", terminal);
+#endif
+	}
+	if (!iterations)
+		iterations = BENCH_DEFAULT_ITERATIONS;
+
+	setup();
+
+	printf("%-22s %10s %12s %12s %12s\n", "phase", "iterations", "p50 (us)", "p99 (us)", "ops/s");
+	measure("is_git_calling_us", iterations, bench_ancestry);
+	measure("parse_prompt", iterations, bench_parse_prompt);
+	measure("canonical_repository", iterations, bench_canonical_repository);
+	measure("git_config", iterations, bench_git_config);
+#if GIT_PASSWORD_WITH_KEYCHAIN
+	measure("create_keychain_item", iterations, bench_create_keychain_item);
+	measure("find_keychain_item", iterations, bench_find_keychain_item);
+	measure("delete_keychain_item", iterations, bench_delete_keychain_item);
+#endif
+	measure("memory_backend_store", iterations, bench_memory_store);
+	measure("memory_backend_lookup", iterations, bench_memory_lookup);
+
+#if GIT_PASSWORD_WITH_KEYCHAIN
+	if (askpass)
+		end_to_end(askpass, iterations);
+#else
+	if (askpass)
+		fatal("--ls-remote needs the keychain backend", terminal);
+#endif
+
+	teardown();
+
+	return 0;
+}
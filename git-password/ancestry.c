@@ -0,0 +1,296 @@
+//
+//  ancestry.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+#if GIT_PASSWORD_WITH_ANCESTRY
+#define ANCESTRY_MAX_HOPS 32
+
+static bool process_info(pid_t pid, struct kinfo_proc * info, FILE * terminal)
+{
+	int name[] = { CTL_KERN, KERN_PROC, KERN_PROC_PID, pid };
+	size_t size = sizeof(*info);
+
+	if (sysctl(name, 4, info, &size, NULL, 0) != 0) fatal("sysctl PROC_PID failed", terminal);
+
+	return size == sizeof(*info);
+}
+
+static bool kernel_lookup(ProcessSource * self, pid_t pid, struct kinfo_proc * info)
+{
+	return process_info(pid, info, self->state);
+}
+
+static bool kernel_snapshot(ProcessSource * self, struct kinfo_proc ** table, size_t * count)
+{
+	int name[] = { CTL_KERN, KERN_PROC, KERN_PROC_ALL };
+	size_t size = 0;
+
+	if (sysctl(name, 3, NULL, &size, NULL, 0) != 0 || (*table = malloc(size)) == NULL)
+		return false;
+	if (sysctl(name, 3, *table, &size, NULL, 0) != 0)
+	{
+		free(*table);
+		return false;
+	}
+	*count = size / sizeof(**table);
+
+	return true;
+}
+
+// A verified parent is remembered as an empty file named after its pid and start
+// time, so the prompt pair git issues from one git-remote-* process walks once.
+static char * ancestry_cache_path(struct kinfo_proc * parent, FILE * terminal)
+{
+	struct timeval started = parent->kp_proc.p_starttime;
+
+	return arena_printf(terminal, "%s/ancestry-%d-%ld.%06d", runtime_directory(terminal), (int)parent->kp_proc.p_pid, (long)started.tv_sec, (int)started.tv_usec);
+}
+
+static int ancestry_cache_ttl(void)
+{
+	const char * ttl = getenv("GIT_PASSWORD_ANCESTRY_CACHE");
+
+	return ttl ? atoi(ttl) : 0;
+}
+
+static bool ancestry_cache_hit(struct kinfo_proc * parent, int ttl, FILE * terminal)
+{
+	char * path = ancestry_cache_path(parent, terminal);
+	struct stat info;
+
+	return stat(path, &info) == 0 && time(NULL) - info.st_mtime < ttl;
+}
+
+// Entries outlive their process, so each store also removes those past the ttl;
+// stores only follow a full walk, at most once per git-remote-* process.
+static void ancestry_cache_prune(int ttl, FILE * terminal)
+{
+	DIR * directory = opendir(runtime_directory(terminal));
+	struct dirent * entry;
+	struct stat info;
+	time_t now = time(NULL);
+
+	if (!directory)
+		return;
+
+	while ((entry = readdir(directory)) != NULL)
+		if (strncmp(entry->d_name, "ancestry-", 9) == 0 && fstatat(dirfd(directory), entry->d_name, &info, AT_SYMLINK_NOFOLLOW) == 0 && now - info.st_mtime >= ttl)
+			unlinkat(dirfd(directory), entry->d_name, 0);
+
+	closedir(directory);
+}
+
+static void ancestry_cache_store(struct kinfo_proc * parent, int ttl, FILE * terminal)
+{
+	char * path = ancestry_cache_path(parent, terminal);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+	if (fd >= 0)
+		close(fd);
+	ancestry_cache_prune(ttl, terminal);
+}
+
+// Walks up from pid, one lookup per hop, until a process named git or
+// ANCESTRY_MAX_HOPS; with a ttl a verified parent is remembered for that long.
+int ancestry_check(ProcessSource * source, pid_t pid, int ttl, FILE * terminal)
+{
+	struct kinfo_proc parent, process;
+
+	if (pid <= 1 || !source->lookup(source, pid, &parent))
+		return 0;
+	if (ttl > 0 && ancestry_cache_hit(&parent, ttl, terminal))
+		return 1;
+
+	process = parent;
+	for (int hops = 0; hops < ANCESTRY_MAX_HOPS; hops++) {
+		if (strcmp(process.kp_proc.p_comm, "git") == 0) {
+			if (ttl > 0)
+				ancestry_cache_store(&parent, ttl, terminal);
+			return 1;
+		}
+
+		pid = process.kp_eproc.e_ppid;
+		if (pid <= 1 || !source->lookup(source, pid, &process))
+			break;
+	}
+
+	return 0;
+}
+
+int is_git_calling_us(FILE * terminal)
+{
+	ProcessSource kernel = { kernel_lookup, kernel_snapshot, terminal };
+
+	return ancestry_check(&kernel, getppid(), ancestry_cache_ttl(), terminal);
+}
+
+// The check as it was first written: copy out the whole process table and
+// search it for every hop. Only the bench still runs it, to compare against.
+int ancestry_scan(ProcessSource * source, pid_t pid)
+{
+	struct kinfo_proc * processes, info;
+	size_t count;
+	int found = 0;
+
+	if (!source->snapshot(source, &processes, &count))
+		return 0;
+
+	while (pid > 1 && !found)
+	{
+		size_t i;
+
+		for (i = 0; i < count && processes[i].kp_proc.p_pid != pid; i++)
+			;
+		if (i == count || !source->lookup(source, pid, &info))
+			break;
+
+		found = strcmp(processes[i].kp_proc.p_comm, "git") == 0;
+		pid = info.kp_eproc.e_ppid;
+	}
+
+	free(processes);
+
+	return found;
+}
+
+// argv[index] of a process, read from its KERN_PROCARGS2 block: argc, the
+// executable path, padding, then the arguments.
+static char * process_argument(pid_t pid, int index, FILE * terminal)
+{
+	int name[] = { CTL_KERN, KERN_PROCARGS2, pid }, limit[] = { CTL_KERN, KERN_ARGMAX };
+	int maximum, argc;
+	size_t size = sizeof(maximum);
+	char * buffer, * cursor, * end, * result = NULL;
+
+	if (sysctl(limit, 2, &maximum, &size, NULL, 0) != 0 || (buffer = malloc(maximum)) == NULL)
+		return NULL;
+
+	size = maximum;
+	if (sysctl(name, 3, buffer, &size, NULL, 0) == 0 && size > sizeof(argc))
+	{
+		memcpy(&argc, buffer, sizeof(argc));
+		end = buffer + size;
+		cursor = buffer + sizeof(argc);
+		cursor += strnlen(cursor, end - cursor);
+		while (cursor < end && !*cursor)
+			cursor++;
+
+		for (int i = 0; i < argc && cursor < end; i++, cursor += strnlen(cursor, end - cursor) + 1)
+			if (i == index)
+			{
+				result = arena_copy(cursor, strnlen(cursor, end - cursor), terminal);
+				break;
+			}
+	}
+
+	free(buffer);
+
+	return result;
+}
+
+// Whether the nearest git above a remote helper runs "push": its first argument
+// that is neither an option nor the value of -c or -C.
+static bool git_is_pushing(pid_t pid, FILE * terminal)
+{
+	struct kinfo_proc process;
+	char * argument;
+
+	for (int hops = 0; ; hops++, pid = process.kp_eproc.e_ppid)
+	{
+		if (hops == ANCESTRY_MAX_HOPS || pid <= 1 || !process_info(pid, &process, terminal))
+			return false;
+		if (strcmp(process.kp_proc.p_comm, "git") == 0)
+			break;
+	}
+
+	for (int i = 1; (argument = process_argument(pid, i, terminal)) != NULL; i++)
+	{
+		if (strcmp(argument, "-c") == 0 || strcmp(argument, "-C") == 0)
+			i++;
+		else if (argument[0] != '-')
+			return strcmp(argument, "push") == 0;
+	}
+
+	return false;
+}
+
+// git runs "git-remote-<scheme> <remote> [<url>]" and that helper runs us, so
+// its arguments say which remote is being contacted when the prompt does not.
+// A url argument has been rewritten by git already; a remote name is looked up
+// the way git itself does, pushurl and pushInsteadOf included for a push.
+char * remote_helper_url(FILE * terminal)
+{
+	struct kinfo_proc process;
+	pid_t pid = getppid();
+	char * remote, * url;
+	const char * configured;
+
+	for (int hops = 0; hops < ANCESTRY_MAX_HOPS && pid > 1 && process_info(pid, &process, terminal); hops++)
+	{
+		if (strcmp(process.kp_proc.p_comm, "git") == 0)
+			break;
+		if (strncmp(process.kp_proc.p_comm, "git-remote-", 11) != 0)
+		{
+			pid = process.kp_eproc.e_ppid;
+			continue;
+		}
+
+		if ((url = process_argument(pid, 2, terminal)) != NULL || (remote = process_argument(pid, 1, terminal)) == NULL)
+			return url;
+		if (git_is_pushing(process.kp_eproc.e_ppid, terminal))
+		{
+			if ((configured = config_get(arena_printf(terminal, "remote.%s.pushurl", remote), terminal)) != NULL)
+				return rewrite_url(configured, terminal);
+			if ((configured = config_get(arena_printf(terminal, "remote.%s.url", remote), terminal)) != NULL)
+				return rewrite_push_url(configured, terminal);
+		}
+		else if ((configured = config_get(arena_printf(terminal, "remote.%s.url", remote), terminal)) != NULL)
+			return rewrite_url(configured, terminal);
+
+		return strchr(remote, ':') ? remote : NULL;
+	}
+
+	return NULL;
+}
+#else
+int is_git_calling_us(FILE * terminal)
+{
+	return 1;
+}
+
+char * remote_helper_url(FILE * terminal)
+{
+	return NULL;
+}
+#endif
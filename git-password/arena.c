@@ -0,0 +1,152 @@
+//
+//  arena.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#define __STDC_WANT_LIB_EXT1__ 1
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "git_password.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+// Strings that only matter while one request is answered (canonical urls, config
+// values, messages) come from here instead of the heap. Nothing is ever freed on
+// its own; arena_reset() wipes what was handed out and starts over, keeping the
+// first chunk so a long-running mode settles at a flat footprint. Every thread
+// has an arena of its own.
+struct ArenaChunk
+{
+	struct ArenaChunk * next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+typedef struct ArenaChunk ArenaChunk;
+
+static _Thread_local ArenaChunk * arena_first = NULL;
+static _Thread_local ArenaChunk * arena_current = NULL;
+static pthread_once_t arena_exit_hook = PTHREAD_ONCE_INIT;
+
+static void arena_register_exit(void)
+{
+	atexit(arena_reset);
+}
+
+static ArenaChunk * arena_chunk(size_t size)
+{
+	ArenaChunk * chunk = malloc(sizeof(ArenaChunk) + size);
+
+	if (chunk)
+	{
+		chunk->next = NULL;
+		chunk->size = size;
+		chunk->used = 0;
+	}
+
+	return chunk;
+}
+
+// Returns zeroed memory that lives until the next arena_reset().
+void * arena_alloc(size_t size, FILE * terminal)
+{
+	ArenaChunk * chunk;
+	void * result;
+
+	size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+	if (!arena_first)
+	{
+		if ((arena_first = arena_current = arena_chunk(ARENA_CHUNK_SIZE)) == NULL)
+			fatal("unable to allocate memory", terminal);
+		pthread_once(&arena_exit_hook, arena_register_exit);
+	}
+
+	if (arena_current->size - arena_current->used < size)
+	{
+		if ((chunk = arena_chunk(size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE)) == NULL)
+			fatal("unable to allocate memory", terminal);
+		arena_current = arena_current->next = chunk;
+	}
+
+	result = arena_current->data + arena_current->used;
+	arena_current->used += size;
+	memset(result, 0, size);
+
+	return result;
+}
+
+char * arena_copy(const void * data, size_t length, FILE * terminal)
+{
+	char * result = arena_alloc(length + 1, terminal);
+
+	memcpy(result, data, length);
+
+	return result;
+}
+
+char * arena_printf(FILE * terminal, const char * format, ...)
+{
+	va_list arguments;
+	int length;
+	char * result;
+
+	va_start(arguments, format);
+	length = vsnprintf(NULL, 0, format, arguments);
+	va_end(arguments);
+	if (length < 0)
+		fatal("unable to format message", terminal);
+
+	result = arena_alloc(length + 1, terminal);
+	va_start(arguments, format);
+	vsnprintf(result, length + 1, format, arguments);
+	va_end(arguments);
+
+	return result;
+}
+
+// Wipes every byte handed out since the last reset with memset_s, which the
+// compiler may not drop, then releases all but the first chunk. Also runs at exit.
+void arena_reset(void)
+{
+	ArenaChunk * chunk, * next;
+
+	if (!arena_first)
+		return;
+
+	memset_s(arena_first->data, arena_first->size, 0, arena_first->used);
+	arena_first->used = 0;
+	for (chunk = arena_first->next; chunk; chunk = next)
+	{
+		next = chunk->next;
+		memset_s(chunk->data, chunk->size, 0, chunk->used);
+		free(chunk);
+	}
+
+	arena_first->next = NULL;
+	arena_current = arena_first;
+}
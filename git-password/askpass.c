@@ -0,0 +1,315 @@
+//
+//  askpass.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+#define PROMPT_LOCK_POLL_MS 50
+#define PROMPT_LOCK_TIMEOUT_MS 120000
+#define PROMPT_MAX_LENGTH 1024
+
+// A repository declined within the negative cache window is reported through
+// *declined without reaching the keychain.
+KeyChainItem * lookup_keychain_item(char * repository, bool include_password, bool * declined, FILE * terminal)
+{
+	Backend * backend = credential_backend(terminal);
+	KeyChainItem * item;
+	OSStatus status = backend->lookup(backend, repository, include_password, &item, terminal);
+
+	*declined = status == errSecUserCanceled;
+	if (status != errSecSuccess && status != errSecItemNotFound && !*declined)
+		security(status, terminal);
+
+	return item;
+}
+
+// Prompting is off when git-password.interactive is false, when GIT_TERMINAL_PROMPT
+// says so, as git itself honours it, or when there is no controlling terminal.
+static bool interactive(char * repository, FILE * terminal)
+{
+	const char * terminal_prompt = getenv("GIT_TERMINAL_PROMPT");
+	int tty;
+
+	if (!git_password_options(repository, terminal).interactive)
+		return false;
+	if (terminal_prompt && !config_bool(terminal_prompt))
+		return false;
+	if ((tty = open("/dev/tty", O_RDWR)) < 0)
+		return false;
+
+	close(tty);
+
+	return true;
+}
+
+#define PROMPT_SIGNALS (sizeof(prompt_signals) / sizeof(prompt_signals[0]))
+
+static const int prompt_signals[] = { SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGTSTP };
+static struct sigaction prompt_actions[PROMPT_SIGNALS];
+static struct termios prompt_saved, prompt_quiet;
+static int prompt_tty = -1;
+
+// As readpassphrase(3) does, a signal during the prompt puts echo back before it
+// takes its default action, and a prompt that was stopped turns echo off again
+// when it is continued. SIGTTOU is held off meanwhile, as the shell may have
+// taken the terminal back before the handler runs.
+static void prompt_interrupted(int signal_number)
+{
+	struct sigaction action = { 0 };
+	sigset_t unblocked;
+	int saved_errno = errno;
+
+	tcsetattr(prompt_tty, TCSANOW, &prompt_saved);
+	signal(signal_number, SIG_DFL);
+	sigemptyset(&unblocked);
+	sigaddset(&unblocked, signal_number);
+	sigprocmask(SIG_UNBLOCK, &unblocked, NULL);
+	raise(signal_number);
+
+	action.sa_handler = prompt_interrupted;
+	sigemptyset(&action.sa_mask);
+	sigaddset(&action.sa_mask, SIGTTOU);
+	sigaction(signal_number, &action, NULL);
+	tcsetattr(prompt_tty, TCSANOW, &prompt_quiet);
+	errno = saved_errno;
+}
+
+// Reads one line from the controlling terminal with echo off, giving up after
+// git-password.promptTimeout seconds when that is set. A longer answer than the
+// buffer holds is refused rather than cut short.
+char * prompt(char * prompt, int timeout, FILE * terminal)
+{
+	double started = trace_enter("prompt");
+	double opened = now_seconds(), deadline = opened + timeout;
+	char buffer[PROMPT_MAX_LENGTH];
+	struct sigaction action = { 0 };
+	struct pollfd pending;
+	size_t length = 0;
+	int tty, ready, wait;
+	bool timed_out = false, too_long = false;
+	char * value;
+
+	if ((tty = open("/dev/tty", O_RDWR)) < 0)
+		fatal("no terminal to prompt on", terminal);
+
+	write(tty, prompt, strlen(prompt));
+	tcgetattr(tty, &prompt_saved);
+	prompt_quiet = prompt_saved;
+	prompt_quiet.c_lflag &= ~(ECHO | ECHONL);
+	prompt_tty = tty;
+	action.sa_handler = prompt_interrupted;
+	sigemptyset(&action.sa_mask);
+	sigaddset(&action.sa_mask, SIGTTOU);
+	for (size_t i = 0; i < PROMPT_SIGNALS; i++)
+		if (sigaction(prompt_signals[i], &action, &prompt_actions[i]) == 0 && prompt_actions[i].sa_handler == SIG_IGN)
+			sigaction(prompt_signals[i], &prompt_actions[i], NULL);
+	tcsetattr(tty, TCSANOW, &prompt_quiet);
+
+	pending.fd = tty;
+	pending.events = POLLIN;
+	for (;;)
+	{
+		wait = -1;
+		if (timeout > 0 && (wait = (int)((deadline - now_seconds()) * 1000)) < 0)
+			wait = 0;
+		if ((ready = poll(&pending, 1, wait)) < 0 && errno == EINTR)
+			continue;
+		if ((timed_out = ready == 0) || ready < 0 || read(tty, buffer + length, 1) <= 0 || buffer[length] == '\n')
+			break;
+		if ((too_long = ++length == sizeof(buffer)))
+			break;
+	}
+
+	// The rest of an answer that is too long must not reach the shell either.
+	tcsetattr(tty, too_long ? TCSAFLUSH : TCSANOW, &prompt_saved);
+	for (size_t i = 0; i < PROMPT_SIGNALS; i++)
+		sigaction(prompt_signals[i], &prompt_actions[i], NULL);
+	prompt_tty = -1;
+	write(tty, "\n", 1);
+	close(tty);
+	stats_record(STAT_PROMPT, now_seconds() - opened, timed_out || too_long ? errSecUserCanceled : errSecSuccess);
+	if (too_long)
+	{
+		memset(buffer, 0, sizeof(buffer));
+		fatal("answer at the prompt is too long", terminal);
+	}
+	if (timed_out)
+		fatal("timed out waiting for an answer at the prompt", terminal);
+
+	value = copy_bytes(buffer, (UInt32)length);
+	memset(buffer, 0, sizeof(buffer));
+	if (!value)
+		fatal("unable to allocate memory", terminal);
+	trace_leave("prompt", started);
+
+	return value;
+}
+
+// git asks either "Username: " or, since 1.7.9, "Username for 'https://user@host/path': ".
+bool parse_prompt(const char * argument, Prompt * result, FILE * terminal)
+{
+	const char * rest, * url, * end;
+
+	if (strncmp(argument, "Username", 8) == 0)
+		result->kind = PROMPT_USERNAME;
+	else if (strncmp(argument, "Password", 8) == 0)
+		result->kind = PROMPT_PASSWORD;
+	else
+		return false;
+
+	rest = argument + 8;
+	result->url = NULL;
+
+	if (strcmp(rest, ": ") == 0)
+		return true;
+	if (strncmp(rest, " for '", 6) != 0)
+		return false;
+
+	url = rest + 6;
+	if ((end = strrchr(url, '\'')) == NULL || strcmp(end, "': ") != 0)
+		return false;
+	result->url = arena_copy(url, end - url, terminal);
+
+	return true;
+}
+
+// The remote being contacted is named by the prompt, or else by the arguments of
+// the git-remote-* helper that ran us; remote.origin.url is only a last resort.
+static char * repository_for(char * url, FILE * terminal)
+{
+	char * target;
+
+	if (url)
+		return canonical_repository(url, terminal);
+	if ((target = remote_helper_url(terminal)) == NULL)
+		target = rewrite_url(git_origin_url(terminal), terminal);
+
+	return canonical_repository(target, terminal);
+}
+
+// Concurrent invocations that all miss the same repository queue up on a lock
+// file; whoever holds it re-checks the keychain, so only the first one prompts.
+static int acquire_prompt_lock(char * repository, FILE * terminal)
+{
+	struct timespec pause = { 0, PROMPT_LOCK_POLL_MS * 1000000L };
+	char * path = arena_printf(terminal, "%s/prompt-%016llx.lock", runtime_directory(terminal), (unsigned long long)hash_string(repository));
+	int fd;
+
+	if ((fd = open(path, O_RDWR | O_CREAT, 0600)) < 0)
+		fatal("unable to open prompt lock", terminal);
+
+	for (int waited = 0; flock(fd, LOCK_EX | LOCK_NB) != 0; waited += PROMPT_LOCK_POLL_MS)
+	{
+		if (errno != EWOULDBLOCK && errno != EINTR)
+			fatal("unable to lock prompt", terminal);
+		if (waited >= PROMPT_LOCK_TIMEOUT_MS)
+			fatal("timed out waiting for another git-password prompt", terminal);
+		nanosleep(&pause, NULL);
+	}
+
+	return fd;
+}
+
+static KeyChainItem * prompt_for_item(char * repository, bool ask_username, FILE * terminal)
+{
+	int lock, timeout;
+	bool declined;
+	KeyChainItem * item;
+	char * message;
+
+	// Without a way to ask, fail now rather than queue behind a prompt.
+	if (!interactive(repository, terminal))
+	{
+		message = arena_printf(terminal, "no credentials for %s in the keychain and prompting is disabled", repository);
+		fatal(message, terminal);
+	}
+
+	lock = acquire_prompt_lock(repository, terminal);
+	item = lookup_keychain_item(repository, true, &declined, terminal);
+
+	if (!item)
+	{
+		if ((item = calloc(1, sizeof(KeyChainItem))) == NULL)
+			fatal("unable to allocate memory", terminal);
+
+		// Whoever held the lock before us may have declined in the meantime;
+		// an empty password declines, and is remembered rather than stored.
+		timeout = git_password_options(repository, terminal).prompt_timeout;
+		item->username = ask_username && !declined ? prompt("Username: ", timeout, terminal) : copy_bytes("", 0);
+		item->password = !declined ? prompt("Password: ", timeout, terminal) : copy_bytes("", 0);
+
+		if (*item->password)
+			security(credential_backend(terminal)->store(credential_backend(terminal), repository, item->username, item->password, 0, terminal), terminal);
+		else if (!declined)
+			negative_cache_store(repository, terminal);
+	}
+
+	close(lock);
+
+	return item;
+}
+
+// Answers are written to fd and the items behind them wiped straight after.
+void get_username(char * url, int fd, FILE * terminal)
+{
+	char * repository = repository_for(url, terminal);
+	bool declined;
+	KeyChainItem * item = lookup_keychain_item(repository, false, &declined, terminal);
+
+	if (!item && !declined)
+		item = prompt_for_item(repository, true, terminal);
+	if (item)
+		write_all(fd, item->username, strlen(item->username));
+
+	free_keychain_item(item);
+}
+
+// The password comes out of whichever store holds it without being copied into
+// this process; only one typed at the prompt passes through our own memory.
+void get_password(char * url, int fd, FILE * terminal)
+{
+	char * repository = repository_for(url, terminal);
+	Backend * backend = credential_backend(terminal);
+	OSStatus status = backend->reveal(backend, repository, fd, terminal);
+	KeyChainItem * item;
+
+	if (status == errSecItemNotFound)
+	{
+		item = prompt_for_item(repository, false, terminal);
+		write_all(fd, item->password, strlen(item->password));
+		free_keychain_item(item);
+	}
+	else if (status != errSecSuccess && status != errSecUserCanceled)
+		security(status, terminal);
+}
@@ -0,0 +1,289 @@
+//
+//  backend.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "git_password.h"
+
+struct MemoryEntry
+{
+	char * repository;
+	KeyChainItem * item;
+	struct MemoryEntry * next;
+};
+typedef struct MemoryEntry MemoryEntry;
+
+struct Chain
+{
+	Backend ** layers;
+	size_t count;
+};
+typedef struct Chain Chain;
+
+static OSStatus memory_lookup(Backend * self, char * repository, bool include_password, KeyChainItem ** result, FILE * terminal)
+{
+	*result = NULL;
+
+	for (MemoryEntry * entry = self->state; entry; entry = entry->next)
+		if (strcmp(entry->repository, repository) == 0)
+			return (*result = copy_item(entry->item)) ? errSecSuccess : errSecAllocate;
+
+	return errSecItemNotFound;
+}
+
+static OSStatus memory_store(Backend * self, char * repository, char * username, char * password, time_t expires, FILE * terminal)
+{
+	KeyChainItem stored = { username, password, expires }, * item = copy_item(&stored);
+	MemoryEntry * entry;
+
+	if (!item)
+		return errSecAllocate;
+
+	for (entry = self->state; entry; entry = entry->next)
+		if (strcmp(entry->repository, repository) == 0)
+		{
+			free_keychain_item(entry->item);
+			entry->item = item;
+			return errSecSuccess;
+		}
+
+	if ((entry = malloc(sizeof(MemoryEntry))) == NULL || (entry->repository = strdup(repository)) == NULL)
+	{
+		free(entry);
+		free_keychain_item(item);
+		return errSecAllocate;
+	}
+
+	entry->item = item;
+	entry->next = self->state;
+	self->state = entry;
+
+	return errSecSuccess;
+}
+
+static OSStatus memory_erase(Backend * self, char * repository, char * username, FILE * terminal)
+{
+	MemoryEntry ** link = (MemoryEntry **)&self->state, * entry;
+
+	for (; (entry = *link) != NULL; link = &entry->next)
+	{
+		if (strcmp(entry->repository, repository) != 0)
+			continue;
+		if (username && *username && strcmp(entry->item->username, username) != 0)
+			return errSecItemNotFound;
+
+		*link = entry->next;
+		free_keychain_item(entry->item);
+		free(entry->repository);
+		free(entry);
+
+		return errSecSuccess;
+	}
+
+	return errSecItemNotFound;
+}
+
+static void memory_close(Backend * self)
+{
+	MemoryEntry * entry, * next;
+
+	for (entry = self->state; entry; entry = next)
+	{
+		next = entry->next;
+		free_keychain_item(entry->item);
+		free(entry->repository);
+		free(entry);
+	}
+	free(self);
+}
+
+// Items held in this process only; zero latency, for the front of a chain and
+// for benchmarks.
+Backend * memory_backend(void)
+{
+	Backend * backend = calloc(1, sizeof(Backend));
+
+	if (!backend)
+		return NULL;
+
+	backend->name = "memory";
+	backend->lookup = memory_lookup;
+	backend->store = memory_store;
+	backend->erase = memory_erase;
+	backend->close = memory_close;
+
+	return backend;
+}
+
+// Layers are asked in order and later ones only on a miss. A hit with the
+// password is copied back into the layers in front of it.
+static OSStatus chain_lookup(Backend * self, char * repository, bool include_password, KeyChainItem ** result, FILE * terminal)
+{
+	Chain * chain = self->state;
+	OSStatus status = errSecItemNotFound;
+	size_t i;
+
+	*result = NULL;
+	for (i = 0; i < chain->count; i++)
+	{
+		status = chain->layers[i]->lookup(chain->layers[i], repository, include_password, result, terminal);
+		if (status != errSecItemNotFound && status != errSecNotAvailable)
+			break;
+	}
+
+	if (status == errSecSuccess && include_password)
+		while (i-- > 0)
+			chain->layers[i]->store(chain->layers[i], repository, (*result)->username, (*result)->password, (*result)->expires, terminal);
+
+	return status;
+}
+
+// The first layer that has the item writes the password; a layer without reveal
+// is looked up instead, and its copy wiped as soon as it has gone out.
+static OSStatus chain_reveal(Backend * self, char * repository, int fd, FILE * terminal)
+{
+	Chain * chain = self->state;
+	OSStatus status = errSecItemNotFound;
+	KeyChainItem * item;
+
+	for (size_t i = 0; i < chain->count; i++)
+	{
+		Backend * layer = chain->layers[i];
+
+		if (layer->reveal)
+			status = layer->reveal(layer, repository, fd, terminal);
+		else if ((status = layer->lookup(layer, repository, true, &item, terminal)) == errSecSuccess)
+		{
+			if (!write_all(fd, item->password, strlen(item->password)))
+				status = errSecIO;
+			free_keychain_item(item);
+		}
+		if (status != errSecItemNotFound && status != errSecNotAvailable)
+			break;
+	}
+
+	return status;
+}
+
+// Stores and erases go to every layer; the first real failure is reported.
+// Erases start at the source, so no cache in front of it can be refilled from
+// a layer that still has the rejected item.
+static OSStatus chain_store(Backend * self, char * repository, char * username, char * password, time_t expires, FILE * terminal)
+{
+	Chain * chain = self->state;
+	OSStatus status, result = errSecSuccess;
+
+	for (size_t i = 0; i < chain->count; i++)
+		if ((status = chain->layers[i]->store(chain->layers[i], repository, username, password, expires, terminal)) != errSecSuccess && status != errSecUnimplemented && result == errSecSuccess)
+			result = status;
+
+	return result;
+}
+
+static OSStatus chain_erase(Backend * self, char * repository, char * username, FILE * terminal)
+{
+	Chain * chain = self->state;
+	OSStatus status, result = errSecItemNotFound;
+
+	for (size_t i = chain->count; i-- > 0; )
+	{
+		status = chain->layers[i]->erase(chain->layers[i], repository, username, terminal);
+		if (status == errSecSuccess && result == errSecItemNotFound)
+			result = errSecSuccess;
+		else if (status != errSecSuccess && status != errSecItemNotFound && status != errSecUnimplemented)
+			result = status;
+	}
+
+	return result;
+}
+
+static void chain_close(Backend * self)
+{
+	Chain * chain = self->state;
+
+	for (size_t i = 0; i < chain->count; i++)
+		chain->layers[i]->close(chain->layers[i]);
+	free(chain->layers);
+	free(chain);
+	free(self);
+}
+
+Backend * chain_backend(Backend ** layers, size_t count)
+{
+	Backend * backend = calloc(1, sizeof(Backend));
+	Chain * chain = calloc(1, sizeof(Chain));
+
+	if (!backend || !chain || (chain->layers = malloc(count * sizeof(Backend *))) == NULL)
+	{
+		free(backend);
+		free(chain);
+		return NULL;
+	}
+
+	memcpy(chain->layers, layers, count * sizeof(Backend *));
+	chain->count = count;
+	backend->name = "chain";
+	backend->lookup = chain_lookup;
+	backend->reveal = chain_reveal;
+	backend->store = chain_store;
+	backend->erase = chain_erase;
+	backend->close = chain_close;
+	backend->state = chain;
+
+	return backend;
+}
+
+// Where credentials ultimately live: the injected map when there is one,
+// otherwise the keychain. A build without the keychain only has the map.
+Backend * source_backend(FILE * terminal)
+{
+#if GIT_PASSWORD_WITH_KEYCHAIN
+	return injected_credentials(terminal) ? injected_backend() : keychain_backend();
+#else
+	injected_credentials(terminal);
+
+	return injected_backend();
+#endif
+}
+
+// memory -> daemon -> declined repositories -> source, built once per process.
+Backend * credential_backend(FILE * terminal)
+{
+	static Backend * backend = NULL;
+
+	if (!backend)
+	{
+#if GIT_PASSWORD_WITH_DAEMON
+		Backend * layers[] = { memory_backend(), daemon_backend(), negative_backend(), source_backend(terminal) };
+#else
+		Backend * layers[] = { memory_backend(), negative_backend(), source_backend(terminal) };
+#endif
+
+		if (!layers[0] || (backend = chain_backend(layers, sizeof(layers) / sizeof(*layers))) == NULL)
+			fatal("unable to allocate memory", terminal);
+	}
+
+	return backend;
+}
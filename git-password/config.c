@@ -0,0 +1,649 @@
+//
+//  config.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+#define CONFIG_BUCKETS 256
+#define CONFIG_MAX_INCLUDE_DEPTH 10
+
+struct ConfigEntry
+{
+	char * key;
+	char * value;
+	struct ConfigEntry * next;
+};
+typedef struct ConfigEntry ConfigEntry;
+
+struct ConfigParser
+{
+	const char * cursor;
+	const char * end;
+	const char * path;
+	int depth;
+	char section[256];
+	char subsection[PATH_MAX];
+};
+typedef struct ConfigParser ConfigParser;
+
+// Every config file git would read is parsed once per process into this table.
+// Entries are kept in file order for iteration and chained newest-first per
+// bucket, so a lookup returns the value that git itself would use.
+static struct
+{
+	bool loaded;
+	char * git_directory;
+	ConfigEntry ** entries;
+	size_t count;
+	size_t capacity;
+	ConfigEntry * buckets[CONFIG_BUCKETS];
+} config;
+
+static void parse_config(const char * path, const char * text, size_t length, int depth, FILE * terminal);
+
+static void config_add(const char * key, const char * value, FILE * terminal)
+{
+	ConfigEntry * entry = malloc(sizeof(ConfigEntry));
+	unsigned bucket = hash_string(key) % CONFIG_BUCKETS;
+
+	if (!entry || (entry->key = strdup(key)) == NULL || (entry->value = strdup(value)) == NULL)
+		fatal("unable to allocate memory", terminal);
+
+	if (config.count == config.capacity)
+	{
+		config.capacity = config.capacity ? config.capacity * 2 : 64;
+		if ((config.entries = realloc(config.entries, config.capacity * sizeof(ConfigEntry *))) == NULL)
+			fatal("unable to allocate memory", terminal);
+	}
+
+	config.entries[config.count++] = entry;
+	entry->next = config.buckets[bucket];
+	config.buckets[bucket] = entry;
+}
+
+static char * read_file(const char * path, size_t * length)
+{
+	struct stat info;
+	char * contents = NULL;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && (contents = malloc(info.st_size + 1)))
+	{
+		ssize_t count = read(fd, contents, info.st_size);
+
+		*length = count > 0 ? count : 0;
+		contents[*length] = 0;
+	}
+
+	close(fd);
+
+	return contents;
+}
+
+static void load_config_file(const char * path, int depth, FILE * terminal)
+{
+	size_t length;
+	char * contents;
+
+	if (!path || depth > CONFIG_MAX_INCLUDE_DEPTH || (contents = read_file(path, &length)) == NULL)
+		return;
+
+	parse_config(path, contents, length, depth, terminal);
+	free(contents);
+}
+
+// ~/ is relative to $HOME and anything else relative to the including file.
+static char * expand_config_path(const char * value, const char * including)
+{
+	char * path = NULL;
+	const char * home = getenv("HOME"), * slash;
+
+	if (strncmp(value, "~/", 2) == 0 && home)
+		asprintf(&path, "%s/%s", home, value + 2);
+	else if (value[0] == '/')
+		path = strdup(value);
+	else if (including && (slash = strrchr(including, '/')))
+		asprintf(&path, "%.*s/%s", (int)(slash - including), including, value);
+
+	return path;
+}
+
+static bool include_condition_holds(const char * condition, const char * including)
+{
+	char * pattern = NULL, * expanded;
+	size_t length;
+	bool fold = false, result;
+
+	if (strncmp(condition, "gitdir:", 7) == 0)
+		condition += 7;
+	else if (strncmp(condition, "gitdir/i:", 9) == 0)
+	{
+		condition += 9;
+		fold = true;
+	}
+	else
+		return false;
+
+	if (!config.git_directory)
+		return false;
+
+	if (strncmp(condition, "./", 2) == 0 || strncmp(condition, "~/", 2) == 0)
+		expanded = expand_config_path(condition[0] == '.' ? condition + 2 : condition, including);
+	else
+		expanded = strdup(condition);
+	if (!expanded)
+		return false;
+
+	length = strlen(expanded);
+	asprintf(&pattern, "%s%s%s", expanded[0] == '/' ? "" : "**/", expanded, length && expanded[length - 1] == '/' ? "**" : "");
+	result = pattern && fnmatch(pattern, config.git_directory, fold ? FNM_CASEFOLD : 0) == 0;
+
+	free(pattern);
+	free(expanded);
+
+	return result;
+}
+
+static void config_set(ConfigParser * parser, const char * name, const char * value, FILE * terminal)
+{
+	char key[PATH_MAX + 512];
+	char * path;
+
+	if (*parser->subsection)
+		snprintf(key, sizeof(key), "%s.%s.%s", parser->section, parser->subsection, name);
+	else
+		snprintf(key, sizeof(key), "%s.%s", parser->section, name);
+
+	config_add(key, value, terminal);
+
+	if (strcmp(name, "path") != 0 || !parser->path)
+		return;
+	if (!(strcmp(parser->section, "include") == 0 && !*parser->subsection) &&
+		!(strcmp(parser->section, "includeif") == 0 && include_condition_holds(parser->subsection, parser->path)))
+		return;
+
+	if ((path = expand_config_path(value, parser->path)))
+		load_config_file(path, parser->depth + 1, terminal);
+	free(path);
+}
+
+static void skip_to_end_of_line(ConfigParser * parser)
+{
+	while (parser->cursor < parser->end && *parser->cursor != '\n')
+		parser->cursor++;
+}
+
+static bool parse_section(ConfigParser * parser)
+{
+	size_t length = 0;
+	char * sub = parser->subsection;
+
+	*parser->subsection = 0;
+
+	for (parser->cursor++; parser->cursor < parser->end && (isalnum((unsigned char)*parser->cursor) || strchr("-.", *parser->cursor)); parser->cursor++)
+	{
+		if (*parser->cursor == '.' && !*parser->subsection && sub == parser->subsection)
+		{
+			// Deprecated [section.subsection] syntax; the subsection is case-insensitive.
+			parser->section[length] = 0;
+			sub = parser->subsection;
+			for (parser->cursor++; parser->cursor < parser->end && *parser->cursor != ']' && sub < parser->subsection + sizeof(parser->subsection) - 1; parser->cursor++)
+				*sub++ = tolower((unsigned char)*parser->cursor);
+			*sub = 0;
+			break;
+		}
+		if (length < sizeof(parser->section) - 1)
+			parser->section[length++] = tolower((unsigned char)*parser->cursor);
+	}
+	parser->section[length] = 0;
+
+	if (parser->cursor < parser->end && isblank((unsigned char)*parser->cursor))
+	{
+		while (parser->cursor < parser->end && isblank((unsigned char)*parser->cursor))
+			parser->cursor++;
+		if (parser->cursor >= parser->end || *parser->cursor != '"')
+			return false;
+
+		for (parser->cursor++; parser->cursor < parser->end && *parser->cursor != '"' && *parser->cursor != '\n'; parser->cursor++)
+		{
+			if (*parser->cursor == '\\' && parser->cursor + 1 < parser->end)
+				parser->cursor++;
+			if (sub < parser->subsection + sizeof(parser->subsection) - 1)
+				*sub++ = *parser->cursor;
+		}
+		*sub = 0;
+
+		if (parser->cursor >= parser->end || *parser->cursor++ != '"')
+			return false;
+	}
+
+	if (parser->cursor >= parser->end || *parser->cursor != ']' || !length)
+		return false;
+
+	parser->cursor++;
+
+	return true;
+}
+
+static char * parse_value(ConfigParser * parser, FILE * terminal)
+{
+	size_t length = 0, capacity = 64, spaces = 0;
+	char * value = malloc(capacity);
+	bool quoted = false;
+
+	if (!value)
+		fatal("unable to allocate memory", terminal);
+
+	while (parser->cursor < parser->end)
+	{
+		char c = *parser->cursor++;
+
+		if (c == '\n' && !quoted)
+			break;
+		if (!quoted && (c == '#' || c == ';'))
+		{
+			skip_to_end_of_line(parser);
+			break;
+		}
+		if (!quoted && isspace((unsigned char)c))
+		{
+			if (length)
+				spaces++;
+			continue;
+		}
+
+		if (c == '"')
+		{
+			quoted = !quoted;
+			c = 0;
+		}
+		else if (c == '\\' && parser->cursor < parser->end)
+		{
+			c = *parser->cursor++;
+			if (c == '\n')
+				continue;
+			else if (c == 'n')
+				c = '\n';
+			else if (c == 't')
+				c = '\t';
+			else if (c == 'b')
+				c = '\b';
+		}
+
+		if (length + spaces + 2 > capacity)
+		{
+			capacity = (length + spaces + 2) * 2;
+			if ((value = realloc(value, capacity)) == NULL)
+				fatal("unable to allocate memory", terminal);
+		}
+		for (; spaces; spaces--)
+			value[length++] = ' ';
+		if (c)
+			value[length++] = c;
+	}
+
+	value[length] = 0;
+
+	return value;
+}
+
+static void parse_config(const char * path, const char * text, size_t length, int depth, FILE * terminal)
+{
+	ConfigParser parser = { text, text + length, path, depth, "", "" };
+
+	while (parser.cursor < parser.end)
+	{
+		char name[256], * value;
+		size_t name_length = 0;
+		char c = *parser.cursor;
+
+		if (isspace((unsigned char)c))
+		{
+			parser.cursor++;
+			continue;
+		}
+		if (c == '#' || c == ';')
+		{
+			skip_to_end_of_line(&parser);
+			continue;
+		}
+		if (c == '[')
+		{
+			if (!parse_section(&parser))
+			{
+				*parser.section = 0;
+				skip_to_end_of_line(&parser);
+			}
+			continue;
+		}
+
+		while (parser.cursor < parser.end && (isalnum((unsigned char)*parser.cursor) || *parser.cursor == '-'))
+		{
+			if (name_length < sizeof(name) - 1)
+				name[name_length++] = tolower((unsigned char)*parser.cursor);
+			parser.cursor++;
+		}
+		name[name_length] = 0;
+
+		while (parser.cursor < parser.end && isblank((unsigned char)*parser.cursor))
+			parser.cursor++;
+
+		if (!name_length || !*parser.section)
+		{
+			skip_to_end_of_line(&parser);
+			continue;
+		}
+
+		if (parser.cursor < parser.end && *parser.cursor == '=')
+		{
+			parser.cursor++;
+			value = parse_value(&parser, terminal);
+			config_set(&parser, name, value, terminal);
+			free(value);
+		}
+		else
+		{
+			skip_to_end_of_line(&parser);
+			config_set(&parser, name, "true", terminal);
+		}
+	}
+}
+
+// "section.Subsection.name" with the section and name folded, as `git -c` does.
+static void add_parameter(const char * key, const char * value, FILE * terminal)
+{
+	char * normalized = strdup(key), * first = NULL, * last = NULL;
+
+	if (!normalized)
+		fatal("unable to allocate memory", terminal);
+	if ((first = strchr(normalized, '.')) == NULL || (last = strrchr(normalized, '.')) == NULL)
+	{
+		free(normalized);
+		return;
+	}
+
+	for (char * c = normalized; c < first; c++)
+		*c = tolower((unsigned char)*c);
+	for (char * c = last; *c; c++)
+		*c = tolower((unsigned char)*c);
+
+	config_add(normalized, value ? value : "true", terminal);
+	free(normalized);
+}
+
+// GIT_CONFIG_PARAMETERS holds git -c options as shell-quoted 'key'='value' words.
+static char * unquote_parameter(const char ** cursor)
+{
+	const char * c = *cursor;
+	char * result = malloc(strlen(c) + 1), * out = result;
+
+	if (!result || *c != '\'')
+	{
+		free(result);
+		return NULL;
+	}
+
+	for (c++; *c; c++)
+	{
+		if (*c != '\'')
+			*out++ = *c;
+		else if (strncmp(c, "'\\''", 4) == 0)
+		{
+			*out++ = '\'';
+			c += 3;
+		}
+		else
+			break;
+	}
+	*out = 0;
+
+	*cursor = *c ? c + 1 : c;
+
+	return result;
+}
+
+static void load_config_parameters(FILE * terminal)
+{
+	const char * parameters = getenv("GIT_CONFIG_PARAMETERS"), * count = getenv("GIT_CONFIG_COUNT");
+
+	while (parameters && *parameters)
+	{
+		char * key, * value = NULL, * equals;
+
+		while (isspace((unsigned char)*parameters))
+			parameters++;
+		if (!*parameters || (key = unquote_parameter(&parameters)) == NULL)
+			break;
+
+		if (*parameters == '=')
+		{
+			parameters++;
+			value = unquote_parameter(&parameters);
+		}
+		else if ((equals = strchr(key, '=')))
+		{
+			*equals = 0;
+			value = strdup(equals + 1);
+		}
+
+		add_parameter(key, value, terminal);
+		free(key);
+		free(value);
+	}
+
+	for (int i = 0, total = count ? atoi(count) : 0; i < total; i++)
+	{
+		char name[64];
+		const char * key, * value;
+
+		snprintf(name, sizeof(name), "GIT_CONFIG_KEY_%d", i);
+		key = getenv(name);
+		snprintf(name, sizeof(name), "GIT_CONFIG_VALUE_%d", i);
+		value = getenv(name);
+
+		if (key && value)
+			add_parameter(key, value, terminal);
+	}
+}
+
+static bool is_git_directory(const char * path)
+{
+	char probe[PATH_MAX];
+	struct stat info;
+
+	snprintf(probe, sizeof(probe), "%s/HEAD", path);
+	if (stat(probe, &info) != 0)
+		return false;
+	snprintf(probe, sizeof(probe), "%s/objects", path);
+
+	return stat(probe, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+// GIT_DIR, or the first .git directory, gitfile or bare repository above the cwd.
+static char * discover_git_directory(void)
+{
+	char directory[PATH_MAX], candidate[PATH_MAX * 2], resolved[PATH_MAX];
+	const char * environment = getenv("GIT_DIR");
+	struct stat info;
+
+	if (environment && *environment)
+		return realpath(environment, resolved) ? strdup(resolved) : strdup(environment);
+	if (!getcwd(directory, sizeof(directory)))
+		return NULL;
+
+	for (;;)
+	{
+		char * slash;
+
+		snprintf(candidate, sizeof(candidate), "%s/.git", directory);
+		if (stat(candidate, &info) == 0 && S_ISDIR(info.st_mode))
+			return strdup(candidate);
+
+		if (stat(candidate, &info) == 0 && S_ISREG(info.st_mode))
+		{
+			size_t length;
+			char * contents = read_file(candidate, &length), * target;
+
+			if (contents && strncmp(contents, "gitdir: ", 8) == 0)
+			{
+				target = trim_trailing_whitespace(contents + 8);
+				if (target[0] == '/')
+					snprintf(candidate, sizeof(candidate), "%s", target);
+				else
+					snprintf(candidate, sizeof(candidate), "%s/%s", directory, target);
+				free(contents);
+
+				return realpath(candidate, resolved) ? strdup(resolved) : strdup(candidate);
+			}
+			free(contents);
+		}
+
+		if (is_git_directory(directory))
+			return strdup(directory);
+
+		if ((slash = strrchr(directory, '/')) == NULL || slash == directory)
+			return NULL;
+		*slash = 0;
+	}
+}
+
+// Linked worktrees keep their config in the main repository's git directory.
+static char * repository_config_path(void)
+{
+	char path[PATH_MAX * 2];
+	size_t length;
+	char * commondir, * result = NULL;
+
+	snprintf(path, sizeof(path), "%s/commondir", config.git_directory);
+	if ((commondir = read_file(path, &length)) != NULL)
+	{
+		trim_trailing_whitespace(commondir);
+		if (commondir[0] == '/')
+			asprintf(&result, "%s/config", commondir);
+		else
+			asprintf(&result, "%s/%s/config", config.git_directory, commondir);
+		free(commondir);
+	}
+	else
+		asprintf(&result, "%s/config", config.git_directory);
+
+	return result;
+}
+
+static void load_config(FILE * terminal)
+{
+	const char * home = getenv("HOME"), * xdg = getenv("XDG_CONFIG_HOME");
+	const char * system = getenv("GIT_CONFIG_SYSTEM"), * global = getenv("GIT_CONFIG_GLOBAL");
+	char * path = NULL;
+
+	config.loaded = true;
+	config.git_directory = discover_git_directory();
+
+	if (!getenv("GIT_CONFIG_NOSYSTEM"))
+		load_config_file(system ? system : "/etc/gitconfig", 0, terminal);
+
+	if (global)
+		load_config_file(global, 0, terminal);
+	else
+	{
+		if (xdg && *xdg)
+			asprintf(&path, "%s/git/config", xdg);
+		else if (home)
+			asprintf(&path, "%s/.config/git/config", home);
+		load_config_file(path, 0, terminal);
+		free(path);
+		path = NULL;
+
+		if (home && asprintf(&path, "%s/.gitconfig", home) >= 0)
+			load_config_file(path, 0, terminal);
+		free(path);
+	}
+
+	if (config.git_directory && (path = repository_config_path()) != NULL)
+	{
+		load_config_file(path, 0, terminal);
+		free(path);
+	}
+
+	load_config_parameters(terminal);
+}
+
+const char * config_get(const char * key, FILE * terminal)
+{
+	if (!config.loaded)
+		load_config(terminal);
+
+	for (ConfigEntry * entry = config.buckets[hash_string(key) % CONFIG_BUCKETS]; entry; entry = entry->next)
+		if (strcmp(entry->key, key) == 0)
+			return entry->value;
+
+	return NULL;
+}
+
+void config_each(void (* visit)(const char * key, const char * value, void * context), void * context, FILE * terminal)
+{
+	if (!config.loaded)
+		load_config(terminal);
+
+	for (size_t i = 0; i < config.count; i++)
+		visit(config.entries[i]->key, config.entries[i]->value, context);
+}
+
+char * git_config(char * key, FILE * terminal)
+{
+	double started = trace_enter("git_config");
+	const char * value = config_get(key, terminal);
+	char * result;
+
+	if (!value)
+		fatal(arena_printf(terminal, "%s is not set in git config", key), terminal);
+	result = arena_copy(value, strlen(value), terminal);
+
+	trace_leave("git_config", started);
+
+	return result;
+}
+
+// Git's spelling of true; an implicit boolean is stored as "true" by the parser.
+bool config_bool(const char * value)
+{
+	return value && (strcasecmp(value, "true") == 0 || strcasecmp(value, "yes") == 0 || strcasecmp(value, "on") == 0 || strcmp(value, "1") == 0);
+}
+
+char * git_origin_url(FILE * terminal)
+{
+	return git_config("remote.origin.url", terminal);
+}
@@ -0,0 +1,174 @@
+//
+//  credential.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+bool read_credential(Credential * credential, FILE * input)
+{
+	char * line = NULL;
+	size_t capacity = 0;
+
+	memset(credential, 0, sizeof(*credential));
+
+	while (getline(&line, &capacity, input) > 0 && strcmp(trim_trailing_whitespace(line), "") != 0)
+	{
+		char * value = strchr(line, '='), ** field = NULL;
+
+		if (!value)
+		{
+			free(line);
+			return false;
+		}
+		*value++ = 0;
+
+		if (strcmp(line, "protocol") == 0)
+			field = &credential->protocol;
+		else if (strcmp(line, "host") == 0)
+			field = &credential->host;
+		else if (strcmp(line, "path") == 0)
+			field = &credential->path;
+		else if (strcmp(line, "url") == 0)
+			field = &credential->url;
+		else if (strcmp(line, "username") == 0)
+			field = &credential->username;
+		else if (strcmp(line, "password") == 0)
+			field = &credential->password;
+		else if (strcmp(line, "password_expiry_utc") == 0)
+			field = &credential->password_expiry_utc;
+		else if (strcmp(line, "quit") == 0)
+			field = &credential->quit;
+
+		if (field)
+		{
+			free(*field);
+			*field = strdup(value);
+		}
+	}
+
+	free(line);
+
+	return true;
+}
+
+void free_credential(Credential * credential)
+{
+	if (credential->password)
+		memset(credential->password, 0, strlen(credential->password));
+
+	free(credential->protocol);
+	free(credential->host);
+	free(credential->path);
+	free(credential->url);
+	free(credential->username);
+	free(credential->password);
+	free(credential->password_expiry_utc);
+	free(credential->quit);
+}
+
+char * credential_url(Credential * credential, FILE * terminal)
+{
+	if (credential->url)
+		return credential->url;
+	if (!credential->protocol || !credential->host)
+		return NULL;
+
+	return arena_printf(terminal, "%s://%s/%s", credential->protocol, credential->host, credential->path ? credential->path : "");
+}
+
+// password_expiry_utc is seconds since the epoch; anything else means none.
+time_t credential_expiry(const Credential * credential)
+{
+	char * end;
+	long long expires;
+
+	if (!credential->password_expiry_utc)
+		return 0;
+	expires = strtoll(credential->password_expiry_utc, &end, 10);
+
+	return end != credential->password_expiry_utc && !*end && expires > 0 ? (time_t)expires : 0;
+}
+
+// The username, password and, for one that expires, password_expiry_utc lines
+// of an answer.
+void write_credential_item(int fd, const KeyChainItem * item)
+{
+	char expires[24];
+
+	write_attribute(fd, "username", item->username);
+	write_attribute(fd, "password", item->password);
+	if (item->expires)
+	{
+		snprintf(expires, sizeof(expires), "%lld", (long long)item->expires);
+		write_attribute(fd, "password_expiry_utc", expires);
+	}
+}
+
+// git credential helper protocol: the action is argv[1], attributes arrive on stdin,
+// and "get" answers with both fields from a single keychain query.
+void credential_helper(const char * action, FILE * terminal)
+{
+	Credential credential;
+	char * url, * repository;
+	Backend * backend = credential_backend(terminal);
+	KeyChainItem * item;
+	bool declined;
+	OSStatus status;
+
+	if (!read_credential(&credential, stdin))
+		fatal("malformed credential attribute", terminal);
+	if ((url = credential_url(&credential, terminal)) == NULL)
+		return;
+	repository = canonical_repository(url, terminal);
+
+	if (strcmp(action, "get") == 0)
+	{
+		item = lookup_keychain_item(repository, true, &declined, terminal);
+		if (declined)
+			write_attribute(STDOUT_FILENO, "quit", "1");
+		else if (item && (!credential.username || strcmp(credential.username, item->username) == 0))
+			write_credential_item(STDOUT_FILENO, item);
+		free_keychain_item(item);
+	}
+	else if (strcmp(action, "store") == 0)
+	{
+		if (!credential.username || !credential.password)
+			return;
+		// An existing item is updated in place, so it survives a failed store.
+		security(backend->store(backend, repository, credential.username, credential.password, credential_expiry(&credential), terminal), terminal);
+	}
+	else if (strcmp(action, "erase") == 0)
+	{
+		if ((status = backend->erase(backend, repository, credential.username, terminal)) != errSecItemNotFound)
+			security(status, terminal);
+	}
+}
+
+bool is_credential_action(const char * argument)
+{
+	return strcmp(argument, "get") == 0 || strcmp(argument, "store") == 0 || strcmp(argument, "erase") == 0;
+}
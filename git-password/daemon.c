@@ -0,0 +1,1043 @@
+//
+//  daemon.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/event.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+#if GIT_PASSWORD_WITH_DAEMON
+#define DAEMON_TIMEOUT_MS 250
+#define DAEMON_REQUEST_TIMEOUT_MS 2000
+#define DAEMON_MAX_REQUEST (1024 * 1024)
+#define DAEMON_MAX_EVENTS 64
+#define DAEMON_BUCKETS 1024
+#define DAEMON_WORKERS 4
+#define DAEMON_SWEEP_SECONDS 30
+
+// NULL once address is filled in, otherwise why it cannot be.
+static const char * daemon_address(struct sockaddr_un * address)
+{
+	const char * directory, * problem;
+
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+
+	if ((directory = find_runtime_directory(&problem)) == NULL)
+		return problem;
+	if (snprintf(address->sun_path, sizeof(address->sun_path), "%s/daemon.sock", directory) >= sizeof(address->sun_path))
+		return "daemon socket path is too long";
+
+	return NULL;
+}
+
+// -1 when no daemon is listening, and with *problem set as well when there is
+// no socket path to try.
+static int daemon_open(const char ** problem)
+{
+	struct sockaddr_un address;
+	struct timeval timeout = { 0, DAEMON_TIMEOUT_MS * 1000 };
+	int fd, on = 1;
+
+	if ((*problem = daemon_address(&address)) != NULL || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int daemon_connect(FILE * terminal)
+{
+	const char * problem;
+	int fd = daemon_open(&problem);
+
+	if (problem)
+		fatal(problem, terminal);
+
+	return fd;
+}
+
+// Any failure to reach the daemon, including a timeout, is reported as a miss. A
+// repository the daemon holds as declined comes back as quit=1, in which case
+// *declined is set and no item is returned.
+KeyChainItem * daemon_lookup(char * repository, bool * declined, FILE * terminal)
+{
+	int fd = daemon_connect(terminal);
+	FILE * reply;
+	Credential credential;
+	KeyChainItem * result = NULL;
+
+	*declined = false;
+	if (fd < 0)
+		return NULL;
+	if (dprintf(fd, "get\nurl=%s\n\n", repository) < 0 || (reply = fdopen(fd, "r")) == NULL)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	if (read_credential(&credential, reply))
+	{
+		if (credential.quit && config_bool(credential.quit))
+			*declined = true;
+		else if (credential.username && credential.password && (result = calloc(1, sizeof(KeyChainItem))))
+		{
+			result->username = credential.username;
+			result->password = credential.password;
+			result->expires = credential_expiry(&credential);
+			credential.username = credential.password = NULL;
+		}
+	}
+
+	free_credential(&credential);
+	fclose(reply);
+
+	return result;
+}
+
+// Hands resolved items to the daemon in one connection; returns how many it kept,
+// or -1 when no daemon is listening.
+int daemon_warm(char ** repositories, KeyChainItem ** items, size_t count, int ttl, FILE * terminal)
+{
+	int fd = daemon_connect(terminal);
+	struct timeval timeout = { 5, 0 };
+	unsigned stored = 0;
+	FILE * reply;
+
+	if (fd < 0)
+		return -1;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	dprintf(fd, "warm %d\n", ttl);
+	for (size_t i = 0; i < count; i++)
+		if (items[i])
+		{
+			write_attribute(fd, "url", repositories[i]);
+			write_credential_item(fd, items[i]);
+			write_all(fd, "\n", 1);
+		}
+	shutdown(fd, SHUT_WR);
+
+	if ((reply = fdopen(fd, "r")) == NULL)
+	{
+		close(fd);
+		return 0;
+	}
+	if (fscanf(reply, "stored=%u", &stored) != 1)
+		stored = 0;
+	fclose(reply);
+
+	return (int)stored;
+}
+
+void daemon_decline(char * repository, FILE * terminal)
+{
+	int fd = daemon_connect(terminal);
+
+	if (fd < 0)
+		return;
+
+	dprintf(fd, "decline\nurl=%s\n\n", repository);
+	close(fd);
+}
+
+// Drops whatever the daemon holds for a repository, credentials or a decline.
+// The reply is awaited, so a get that follows cannot be answered from the
+// entry just rejected; returns whether there was one.
+bool daemon_forget(char * repository, FILE * terminal)
+{
+	int fd = daemon_connect(terminal);
+	unsigned erased = 0;
+	FILE * reply;
+
+	if (fd < 0)
+		return false;
+	if (dprintf(fd, "erase\nurl=%s\n\n", repository) < 0 || (reply = fdopen(fd, "r")) == NULL)
+	{
+		close(fd);
+		return false;
+	}
+	if (fscanf(reply, "erased=%u", &erased) != 1)
+		erased = 0;
+	fclose(reply);
+
+	return erased > 0;
+}
+
+// Counts the events of a front end, one "<event> <seconds> <status>" line each;
+// nothing is sent back and nothing is awaited, so they are lost when no daemon
+// is running. It runs from an atexit handler, so a runtime directory that cannot
+// be had makes it give up quietly rather than call fatal.
+void daemon_report(const char * reports)
+{
+	const char * problem;
+	int fd = daemon_open(&problem);
+
+	if (fd < 0)
+		return;
+
+	dprintf(fd, "report\n%s\n", reports);
+	close(fd);
+}
+
+// Copies the daemon's counters to fd; false when no daemon is listening.
+bool daemon_stats(int fd, bool json, FILE * terminal)
+{
+	int daemon = daemon_connect(terminal);
+	struct timeval timeout = { 5, 0 };
+	char buffer[4096];
+	ssize_t count;
+
+	if (daemon < 0)
+		return false;
+
+	setsockopt(daemon, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	dprintf(daemon, json ? "stats json\n\n" : "stats\n\n");
+	while ((count = read(daemon, buffer, sizeof(buffer))) > 0)
+		write_all(fd, buffer, count);
+	close(daemon);
+
+	return true;
+}
+
+static OSStatus daemon_backend_lookup(Backend * self, char * repository, bool include_password, KeyChainItem ** result, FILE * terminal)
+{
+	bool declined;
+
+	if ((*result = daemon_lookup(repository, &declined, terminal)) != NULL)
+		return errSecSuccess;
+
+	return declined ? errSecUserCanceled : errSecItemNotFound;
+}
+
+static OSStatus daemon_backend_store(Backend * self, char * repository, char * username, char * password, time_t expires, FILE * terminal)
+{
+	return errSecUnimplemented;
+}
+
+// git erases a credential it was refused with; the cached copy goes with it
+// whatever the username, as a later get reads it back from the source.
+static OSStatus daemon_backend_erase(Backend * self, char * repository, char * username, FILE * terminal)
+{
+	return daemon_forget(repository, terminal) ? errSecSuccess : errSecItemNotFound;
+}
+
+static void daemon_backend_close(Backend * self)
+{
+}
+
+Backend * daemon_backend(void)
+{
+	static Backend backend = { "daemon", daemon_backend_lookup, NULL, daemon_backend_store, daemon_backend_erase, daemon_backend_close, NULL };
+
+	return &backend;
+}
+
+// The username and password of an entry share one cell of the locked secret
+// slab; an entry without one marks a repository the user declined. Entries never
+// change once published: the event loop reads the table without taking a lock,
+// while workers and the loop change it under daemon_cache_lock by linking in a
+// new entry and unlinking the old one. What was unlinked is freed by the loop
+// between two rounds of events, the only moment it is sure not to be reading.
+struct CacheEntry
+{
+	char * repository;
+	KeyChainItem item;
+	time_t expires;
+	unsigned generation;
+	struct CacheEntry * next;
+	struct CacheEntry * retired;
+};
+typedef struct CacheEntry CacheEntry;
+
+// A request is read by the event loop until it is complete, then answered inline
+// or handed to a worker together with its buffer. The sweep also queues requests
+// of its own, without a client, to renew a credential that is about to expire;
+// those stay on daemon_refreshing until done, so each repository has one at most.
+struct DaemonRequest
+{
+	int client;
+	char * buffer;
+	size_t length;
+	size_t capacity;
+	double accepted;
+	double deadline;
+	char * refresh;
+	struct DaemonRequest * next;
+	struct DaemonRequest * refreshing;
+};
+typedef struct DaemonRequest DaemonRequest;
+
+static CacheEntry * daemon_cache[DAEMON_BUCKETS];
+static CacheEntry * daemon_retired = NULL;
+static DaemonRequest * daemon_refreshing = NULL;
+static pthread_mutex_t daemon_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static DaemonRequest * daemon_jobs = NULL, ** daemon_jobs_tail = &daemon_jobs;
+static pthread_mutex_t daemon_jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t daemon_jobs_ready = PTHREAD_COND_INITIALIZER;
+
+static int daemon_ttl = 0;
+static int daemon_listener = -1;
+
+// Bumped under daemon_cache_lock whenever the keychain changes underneath the
+// cache, so a lookup that raced with the change does not put back what it read.
+static unsigned daemon_generation = 0;
+static unsigned daemon_stale = 0;
+
+#define CACHE_LOAD(link) __atomic_load_n(&(link), __ATOMIC_ACQUIRE)
+#define CACHE_PUBLISH(link, value) __atomic_store_n(&(link), (value), __ATOMIC_RELEASE)
+
+static CacheEntry ** daemon_bucket(const char * repository)
+{
+	return &daemon_cache[hash_string(repository) % DAEMON_BUCKETS];
+}
+
+// Lock-free on the event loop; workers only call it holding daemon_cache_lock.
+static CacheEntry * daemon_cache_find(const char * repository)
+{
+	time_t now = time(NULL);
+
+	for (CacheEntry * entry = CACHE_LOAD(*daemon_bucket(repository)); entry; entry = CACHE_LOAD(entry->next))
+		if (entry->expires > now && strcmp(entry->repository, repository) == 0)
+			return entry;
+
+	return NULL;
+}
+
+// Called with daemon_cache_lock held. Readers already on the entry still see
+// its next link, so they carry on past it.
+static void daemon_cache_unlink(CacheEntry ** link, CacheEntry * entry)
+{
+	CACHE_PUBLISH(*link, entry->next);
+	entry->retired = daemon_retired;
+	CACHE_PUBLISH(daemon_retired, entry);
+}
+
+// Frees what writers unlinked; only the event loop calls this.
+static void daemon_cache_reclaim(void)
+{
+	CacheEntry * entry, * next;
+
+	if (!CACHE_LOAD(daemon_retired))
+		return;
+
+	pthread_mutex_lock(&daemon_cache_lock);
+	entry = daemon_retired;
+	daemon_retired = NULL;
+	pthread_mutex_unlock(&daemon_cache_lock);
+
+	for (; entry; entry = next)
+	{
+		next = entry->retired;
+		secret_free(entry->item.username);
+		free(entry->repository);
+		free(entry);
+	}
+}
+
+// Takes over item, moving it into the slab and wiping the heap copy; a NULL item
+// records a decline. The new entry goes in front of any older one for the same
+// repository before that is unlinked, so readers never see a gap. An entry
+// lasts no longer than the credential it holds, and is dropped when the keychain
+// changed after generation was read.
+static bool daemon_cache_put(char * repository, KeyChainItem * item, int ttl, unsigned generation)
+{
+	size_t username_length = item ? strlen(item->username) + 1 : 0;
+	size_t password_length = item ? strlen(item->password) + 1 : 0;
+	CacheEntry ** link, * entry = NULL, * existing;
+	char * secret = NULL;
+	time_t now = time(NULL);
+
+	if ((item && item->expires && item->expires <= now) || (entry = calloc(1, sizeof(CacheEntry))) == NULL || (entry->repository = strdup(repository)) == NULL || (item && (secret = secret_alloc(username_length + password_length)) == NULL))
+	{
+		if (entry && entry->repository)
+			fprintf(stderr, "warning: no locked memory left to cache %s\n", repository);
+		if (entry)
+			free(entry->repository);
+		free(entry);
+		free_keychain_item(item);
+		return false;
+	}
+	entry->expires = now + ttl;
+	entry->generation = generation;
+	if (secret)
+	{
+		memcpy(secret, item->username, username_length);
+		memcpy(secret + username_length, item->password, password_length);
+		if ((entry->item.expires = item->expires) && item->expires < entry->expires)
+			entry->expires = item->expires;
+		free_keychain_item(item);
+	}
+	entry->item.username = secret;
+	entry->item.password = secret ? secret + username_length : NULL;
+
+	pthread_mutex_lock(&daemon_cache_lock);
+	if (generation != daemon_generation)
+	{
+		pthread_mutex_unlock(&daemon_cache_lock);
+		secret_free(entry->item.username);
+		free(entry->repository);
+		free(entry);
+		return false;
+	}
+	link = daemon_bucket(repository);
+	entry->next = *link;
+	CACHE_PUBLISH(*link, entry);
+	for (link = &entry->next; (existing = *link) != NULL; )
+	{
+		if (existing->expires <= now || strcmp(existing->repository, repository) == 0)
+			daemon_cache_unlink(link, existing);
+		else
+			link = &existing->next;
+	}
+	pthread_mutex_unlock(&daemon_cache_lock);
+
+	return true;
+}
+
+// A credential put before the last event that could not be tied to a
+// repository; declines are never stale.
+static bool daemon_cache_stale(const CacheEntry * entry)
+{
+	return entry->item.username && entry->generation < CACHE_LOAD(daemon_stale);
+}
+
+// For a worker: another worker may have put the repository while this request
+// waited in the queue. True when a live entry was found; *result is a copy of
+// its credential, or NULL for a decline.
+static bool daemon_cache_copy(const char * repository, KeyChainItem ** result)
+{
+	CacheEntry * entry;
+	bool found;
+
+	pthread_mutex_lock(&daemon_cache_lock);
+	found = (entry = daemon_cache_find(repository)) != NULL && !daemon_cache_stale(entry);
+	*result = found && entry->item.username ? copy_item(&entry->item) : NULL;
+	found = found && (*result || !entry->item.username);
+	pthread_mutex_unlock(&daemon_cache_lock);
+
+	return found;
+}
+
+// Unlinks every entry for a repository; returns how many were live.
+static unsigned daemon_cache_forget(const char * repository)
+{
+	time_t now = time(NULL);
+	CacheEntry ** link, * entry;
+	unsigned forgotten = 0;
+
+	pthread_mutex_lock(&daemon_cache_lock);
+	for (link = daemon_bucket(repository); (entry = *link) != NULL; )
+	{
+		if (strcmp(entry->repository, repository) == 0)
+		{
+			forgotten += entry->expires > now;
+			daemon_cache_unlink(link, entry);
+		}
+		else
+			link = &entry->next;
+	}
+	pthread_mutex_unlock(&daemon_cache_lock);
+
+	return forgotten;
+}
+
+// Called on the main thread for every keychain item another process adds,
+// modifies or deletes; only the entries of the affected repository go. An event
+// without a repository, typically for an item already deleted, marks every
+// credential cached so far as stale instead: each is checked against the
+// keychain again the next time it is asked for, on a worker.
+static void daemon_keychain_changed(const char * repository)
+{
+	pthread_mutex_lock(&daemon_cache_lock);
+	CACHE_PUBLISH(daemon_generation, daemon_generation + 1);
+	pthread_mutex_unlock(&daemon_cache_lock);
+
+	if (repository)
+		daemon_cache_forget(repository);
+	else
+		CACHE_PUBLISH(daemon_stale, CACHE_LOAD(daemon_generation));
+	stats_record(STAT_INVALIDATION, -1, errSecSuccess);
+}
+
+static void daemon_queue(DaemonRequest * request)
+{
+	request->next = NULL;
+
+	pthread_mutex_lock(&daemon_jobs_lock);
+	*daemon_jobs_tail = request;
+	daemon_jobs_tail = &request->next;
+	pthread_cond_signal(&daemon_jobs_ready);
+	pthread_mutex_unlock(&daemon_jobs_lock);
+}
+
+// Called with daemon_cache_lock held.
+static bool daemon_refresh_pending(const char * repository)
+{
+	for (DaemonRequest * request = daemon_refreshing; request; request = request->refreshing)
+		if (strcmp(request->refresh, repository) == 0)
+			return true;
+
+	return false;
+}
+
+// Unlinks expired entries that no request has come across since they lapsed,
+// and queues a refresh for every credential the refresh command should renew.
+static void daemon_cache_sweep(void)
+{
+	time_t now = time(NULL);
+	CacheEntry ** link, * entry;
+	DaemonRequest * refreshes = NULL, * request;
+
+	pthread_mutex_lock(&daemon_cache_lock);
+	for (size_t i = 0; i < DAEMON_BUCKETS; i++)
+		for (link = &daemon_cache[i]; (entry = *link) != NULL; )
+		{
+			if (entry->expires <= now)
+			{
+				daemon_cache_unlink(link, entry);
+				continue;
+			}
+			if (entry->item.username && refresh_due(entry->repository, entry->item.expires) && !daemon_refresh_pending(entry->repository) && (request = calloc(1, sizeof(DaemonRequest))) != NULL)
+			{
+				if ((request->refresh = strdup(entry->repository)) == NULL)
+					free(request);
+				else
+				{
+					request->client = -1;
+					request->refreshing = daemon_refreshing;
+					daemon_refreshing = request;
+					request->next = refreshes;
+					refreshes = request;
+				}
+			}
+			link = &entry->next;
+		}
+	pthread_mutex_unlock(&daemon_cache_lock);
+
+	for (; refreshes; refreshes = request)
+	{
+		request = refreshes->next;
+		daemon_queue(refreshes);
+	}
+
+	daemon_cache_reclaim();
+}
+
+// Renews a cached credential on a worker. The keychain item is updated by
+// refresh_credentials; the new entry replaces the old one in the cache.
+static void daemon_refresh(DaemonRequest * request)
+{
+	DaemonRequest ** link;
+	CacheEntry * entry;
+	KeyChainItem * item = NULL;
+	char * username = NULL;
+	unsigned generation;
+
+	pthread_mutex_lock(&daemon_cache_lock);
+	if ((entry = daemon_cache_find(request->refresh)) != NULL && entry->item.username)
+		username = strdup(entry->item.username);
+	generation = daemon_generation;
+	pthread_mutex_unlock(&daemon_cache_lock);
+
+	if (username && (item = refresh_credentials(request->refresh, username, stderr)) != NULL)
+		daemon_cache_put(request->refresh, item, daemon_ttl ? daemon_ttl : git_password_options(request->refresh, stderr).cache_ttl, generation);
+	free(username);
+
+	pthread_mutex_lock(&daemon_cache_lock);
+	for (link = &daemon_refreshing; *link != request; link = &(*link)->refreshing)
+		;
+	*link = request->refreshing;
+	pthread_mutex_unlock(&daemon_cache_lock);
+}
+
+static void daemon_reply(int client, KeyChainItem * item)
+{
+	if (item->username)
+		write_credential_item(client, item);
+	else
+		write_attribute(client, "quit", "1");
+}
+
+// "warm <ttl>" is followed by one credential block per repository until the
+// client shuts down its side; the count stored is sent back.
+static void daemon_warm_entries(int client, FILE * input, int ttl)
+{
+	Credential entry;
+	KeyChainItem * item;
+	unsigned stored = 0;
+
+	while (!feof(input) && read_credential(&entry, input))
+	{
+		if (entry.url && entry.username && entry.password && (item = calloc(1, sizeof(KeyChainItem))))
+		{
+			item->username = entry.username;
+			item->password = entry.password;
+			item->expires = credential_expiry(&entry);
+			entry.username = entry.password = NULL;
+			if (daemon_cache_put(entry.url, item, ttl > 0 ? ttl : git_password_options(entry.url, stderr).cache_ttl, CACHE_LOAD(daemon_generation)))
+				stored++;
+		}
+		free_credential(&entry);
+	}
+
+	dprintf(client, "stored=%u\n", stored);
+}
+
+// Answers a complete request. On the event loop (worker false) only cache hits,
+// declines, erases and reports are handled; anything that has to wait on
+// securityd, and the stats, return false and are queued for a worker instead.
+static bool daemon_answer(DaemonRequest * request, bool worker)
+{
+	FILE * input = fmemopen(request->buffer, request->length, "r");
+	Credential credential = { NULL };
+	char * action = NULL;
+	size_t capacity = 0;
+	Backend * source;
+	CacheEntry * entry;
+	KeyChainItem * item;
+	int negative_ttl;
+	bool answered = true;
+	double started;
+	unsigned generation;
+	OSStatus status;
+
+	if (!input)
+		return true;
+
+	if (getline(&action, &capacity, input) <= 0)
+		;
+	else if (strncmp(trim_trailing_whitespace(action), "warm ", 5) == 0)
+	{
+		if ((answered = worker))
+			daemon_warm_entries(request->client, input, atoi(action + 5));
+	}
+	else if (strcmp(action, "report") == 0)
+	{
+		while (getline(&action, &capacity, input) > 1)
+			stats_report(action);
+	}
+	else if (strcmp(action, "stats") == 0 || strcmp(action, "stats json") == 0)
+	{
+		if ((answered = worker))
+			stats_write(request->client, strcmp(action, "stats json") == 0);
+	}
+	else if (read_credential(&credential, input) && credential.url)
+	{
+		if (strcmp(action, "get") == 0 && !worker && (entry = daemon_cache_find(credential.url)) && !daemon_cache_stale(entry))
+		{
+			daemon_reply(request->client, &entry->item);
+			stats_record(entry->item.username ? STAT_HIT : STAT_NEGATIVE_HIT, now_seconds() - request->accepted, errSecSuccess);
+		}
+		else if (strcmp(action, "get") == 0 && worker && daemon_cache_copy(credential.url, &item))
+		{
+			if (item)
+				daemon_reply(request->client, item);
+			else
+				write_attribute(request->client, "quit", "1");
+			stats_record(item ? STAT_HIT : STAT_NEGATIVE_HIT, now_seconds() - request->accepted, errSecSuccess);
+			free_keychain_item(item);
+		}
+		else if (strcmp(action, "get") == 0 && (answered = worker))
+		{
+			source = source_backend(stderr);
+			generation = CACHE_LOAD(daemon_generation);
+			started = now_seconds();
+			status = source->lookup(source, credential.url, true, &item, stderr);
+			stats_record(STAT_KEYCHAIN_LOOKUP, now_seconds() - started, status);
+			if (status == errSecSuccess)
+			{
+				daemon_reply(request->client, item);
+				daemon_cache_put(credential.url, item, daemon_ttl ? daemon_ttl : git_password_options(credential.url, stderr).cache_ttl, generation);
+			}
+			stats_record(STAT_MISS, now_seconds() - request->accepted, errSecSuccess);
+		}
+		else if (strcmp(action, "erase") == 0)
+			dprintf(request->client, "erased=%u\n", daemon_cache_forget(credential.url));
+		else if (strcmp(action, "decline") == 0 && (negative_ttl = git_password_options(credential.url, stderr).negative_ttl) > 0)
+			daemon_cache_put(credential.url, NULL, negative_ttl, CACHE_LOAD(daemon_generation));
+	}
+
+	free_credential(&credential);
+	free(action);
+	fclose(input);
+
+	return answered;
+}
+
+// Warm requests carry passwords, so every buffer is wiped before it goes.
+static void daemon_finish(DaemonRequest * request)
+{
+	if (request->client >= 0)
+		close(request->client);
+	if (request->buffer)
+		memset(request->buffer, 0, request->capacity);
+	free(request->buffer);
+	free(request->refresh);
+	free(request);
+	arena_reset();
+}
+
+static void * daemon_worker(void * context)
+{
+	DaemonRequest * request;
+
+	trace_thread("worker");
+
+	for (;;)
+	{
+		pthread_mutex_lock(&daemon_jobs_lock);
+		while (!daemon_jobs)
+			pthread_cond_wait(&daemon_jobs_ready, &daemon_jobs_lock);
+		request = daemon_jobs;
+		if ((daemon_jobs = request->next) == NULL)
+			daemon_jobs_tail = &daemon_jobs;
+		pthread_mutex_unlock(&daemon_jobs_lock);
+
+		if (request->refresh)
+			daemon_refresh(request);
+		else
+			daemon_answer(request, true);
+		daemon_finish(request);
+	}
+
+	return NULL;
+}
+
+// A get or decline is complete at the blank line ending its block; warm only
+// once the client has shut down writing.
+static bool daemon_request_complete(DaemonRequest * request, bool closed)
+{
+	if (request->length >= 5 && strncmp(request->buffer, "warm ", 5) == 0)
+		return closed;
+
+	return closed || memmem(request->buffer, request->length, "\n\n", 2) != NULL;
+}
+
+// Reads what has arrived; returns false once the connection should be dropped.
+static bool daemon_read(DaemonRequest * request, bool * complete)
+{
+	ssize_t count;
+	char * grown;
+
+	*complete = false;
+	for (;;)
+	{
+		if (request->length == request->capacity)
+		{
+			if (request->capacity >= DAEMON_MAX_REQUEST)
+				return false;
+			if ((grown = malloc(request->capacity ? request->capacity * 2 : 4096)) == NULL)
+				return false;
+			if (request->buffer)
+			{
+				memcpy(grown, request->buffer, request->length);
+				memset(request->buffer, 0, request->capacity);
+				free(request->buffer);
+			}
+			request->buffer = grown;
+			request->capacity = request->capacity ? request->capacity * 2 : 4096;
+		}
+
+		if ((count = read(request->client, request->buffer + request->length, request->capacity - request->length)) > 0)
+			request->length += count;
+		else if (count < 0 && errno == EINTR)
+			continue;
+		else if (count < 0 && errno == EAGAIN)
+		{
+			*complete = daemon_request_complete(request, false);
+			return true;
+		}
+		else
+		{
+			*complete = count == 0 && request->length > 0 && daemon_request_complete(request, true);
+			return *complete;
+		}
+	}
+}
+
+static void daemon_accept(int queue, int listener, DaemonRequest ** pending)
+{
+	struct kevent change;
+	DaemonRequest * request;
+	uid_t uid;
+	gid_t gid;
+	int client;
+
+	while ((client = accept(listener, NULL, NULL)) >= 0)
+	{
+		if (getpeereid(client, &uid, &gid) != 0 || uid != getuid() || (request = calloc(1, sizeof(DaemonRequest))) == NULL)
+		{
+			close(client);
+			continue;
+		}
+
+		fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+		request->client = client;
+		request->accepted = now_seconds();
+		request->deadline = request->accepted + DAEMON_REQUEST_TIMEOUT_MS / 1000.0;
+		request->next = *pending;
+		*pending = request;
+
+		EV_SET(&change, client, EVFILT_READ, EV_ADD, 0, 0, request);
+		if (kevent(queue, &change, 1, NULL, 0, NULL) != 0)
+		{
+			*pending = request->next;
+			daemon_finish(request);
+		}
+	}
+}
+
+// A complete request leaves the pending list and is answered here or queued for
+// a worker, which then owns its descriptor.
+static void daemon_dispatch(int queue, DaemonRequest ** pending, DaemonRequest * request)
+{
+	struct timeval timeout = { 0, DAEMON_TIMEOUT_MS * 1000 };
+	struct kevent change;
+	DaemonRequest ** link = pending;
+
+	while (*link != request)
+		link = &(*link)->next;
+	*link = request->next;
+
+	EV_SET(&change, request->client, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	kevent(queue, &change, 1, NULL, 0, NULL);
+
+	// Replies are written whole: the socket blocks from here on, and a client
+	// that stops reading holds up the loop or a worker for DAEMON_TIMEOUT_MS at
+	// most. A reply fits the socket buffer, so in practice nothing waits.
+	fcntl(request->client, F_SETFL, fcntl(request->client, F_GETFL) & ~O_NONBLOCK);
+	setsockopt(request->client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	if (daemon_answer(request, false))
+		daemon_finish(request);
+	else
+		daemon_queue(request);
+}
+
+// Drops connections that did not send a whole request in time. Only called
+// between rounds of events, so no event still refers to them.
+static void daemon_expire(DaemonRequest ** pending, double now)
+{
+	DaemonRequest ** link = pending, * request;
+
+	while ((request = *link) != NULL)
+	{
+		if (request->deadline > now)
+		{
+			link = &request->next;
+			continue;
+		}
+		*link = request->next;
+		daemon_finish(request);
+	}
+}
+
+// One thread owns the socket and every connection on it through kqueue. Requests
+// are read without blocking, cache hits, declines and erases are answered on the
+// spot, and keychain misses and warm batches go to a pool of workers, so a slow
+// or prompting securityd call holds up nobody but the process that asked.
+static void daemon_loop(int listener, FILE * terminal)
+{
+	struct kevent change, events[DAEMON_MAX_EVENTS];
+	struct timespec wait;
+	DaemonRequest * pending = NULL, * request;
+	double now, next_sweep = now_seconds() + DAEMON_SWEEP_SECONDS, wake;
+	pthread_t worker;
+	int queue, count;
+	bool complete;
+
+	for (int i = 0; i < DAEMON_WORKERS; i++)
+		if (pthread_create(&worker, NULL, daemon_worker, NULL) != 0)
+			fatal("unable to start daemon workers", terminal);
+		else
+			pthread_detach(worker);
+
+	if ((queue = kqueue()) < 0)
+		fatal("kqueue failed", terminal);
+	fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+	EV_SET(&change, listener, EVFILT_READ, EV_ADD, 0, 0, NULL);
+	if (kevent(queue, &change, 1, NULL, 0, NULL) != 0)
+		fatal("kevent failed", terminal);
+
+	for (;;)
+	{
+		daemon_cache_reclaim();
+
+		wake = next_sweep;
+		for (request = pending; request; request = request->next)
+			if (request->deadline < wake)
+				wake = request->deadline;
+		now = now_seconds();
+		wait.tv_sec = wake > now ? (time_t)(wake - now) : 0;
+		wait.tv_nsec = wake > now ? (long)((wake - now - wait.tv_sec) * 1e9) : 0;
+
+		if ((count = kevent(queue, NULL, 0, events, DAEMON_MAX_EVENTS, &wait)) < 0 && errno != EINTR)
+			fatal("kevent failed", terminal);
+
+		for (int i = 0; i < count; i++)
+		{
+			if ((request = events[i].udata) == NULL)
+			{
+				daemon_accept(queue, listener, &pending);
+				continue;
+			}
+
+			// A broken connection is dropped along with the timed-out ones below.
+			if (!daemon_read(request, &complete))
+				request->deadline = 0;
+			else if (complete)
+				daemon_dispatch(queue, &pending, request);
+		}
+
+		if ((now = now_seconds()) >= next_sweep)
+		{
+			daemon_cache_sweep();
+			next_sweep = now + DAEMON_SWEEP_SECONDS;
+		}
+		daemon_expire(&pending, now);
+	}
+}
+
+static void * daemon_serve(void * context)
+{
+	trace_thread("serve");
+	daemon_loop(daemon_listener, context);
+
+	return NULL;
+}
+
+// git-password --daemon [--ttl <seconds>]: keep resolved items in memory and answer
+// the askpass and helper front ends over a socket in the private runtime directory.
+// Without --ttl each entry lives for git-password.cacheTtl of its repository.
+void run_daemon(int argc, const char * argv[], FILE * terminal)
+{
+	struct sockaddr_un address;
+	const char * problem;
+	int listener, client;
+	double started = trace_enter("daemon_start");
+
+	for (int i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--ttl") == 0 && i + 1 < argc)
+		{
+			if ((daemon_ttl = atoi(argv[++i])) <= 0)
+				fatal("cache ttl must be positive", terminal);
+		}
+		else
+			fatal("usage: git-password --daemon [--ttl <seconds>]", terminal);
+	}
+	// Parse the config and any injected credentials now, so a bad value stops the
+	// daemon rather than a request, a pipe is drained while it is still open, and
+	// the workers only ever read what is loaded here.
+	git_password_options(NULL, terminal);
+	if (!injected_credentials(terminal))
+		security_api();
+	stats_serve();
+
+	if ((client = daemon_connect(terminal)) >= 0)
+		fatal("daemon is already running", terminal);
+
+	if ((problem = daemon_address(&address)) != NULL)
+		fatal(problem, terminal);
+	unlink(address.sun_path);
+
+	if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) fatal("socket failed", terminal);
+	if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0) fatal("bind failed", terminal);
+	if (listen(listener, SOMAXCONN) != 0) fatal("listen failed", terminal);
+
+	signal(SIGPIPE, SIG_IGN);
+	trace_leave("daemon_start", started);
+
+	// Keychain events are delivered to the main thread's run loop, so when they
+	// can be had the event loop moves to a thread of its own. Entries then only
+	// outlive the keychain item they came from by the time an event takes.
+	if (!injected_credentials(terminal) && watch_keychain(daemon_keychain_changed))
+	{
+		pthread_t loop;
+
+		daemon_listener = listener;
+		if (pthread_create(&loop, NULL, daemon_serve, terminal) != 0)
+			fatal("unable to start the daemon", terminal);
+		run_keychain_events();
+		pthread_join(loop, NULL);
+	}
+	else
+		daemon_loop(listener, terminal);
+}
+#else
+KeyChainItem * daemon_lookup(char * repository, bool * declined, FILE * terminal)
+{
+	*declined = false;
+
+	return NULL;
+}
+
+int daemon_warm(char ** repositories, KeyChainItem ** items, size_t count, int ttl, FILE * terminal)
+{
+	return -1;
+}
+
+void daemon_decline(char * repository, FILE * terminal)
+{
+}
+
+bool daemon_forget(char * repository, FILE * terminal)
+{
+	return false;
+}
+
+void daemon_report(const char * reports)
+{
+}
+
+bool daemon_stats(int fd, bool json, FILE * terminal)
+{
+	return false;
+}
+
+void run_daemon(int argc, const char * argv[], FILE * terminal)
+{
+	fatal("built without the daemon", terminal);
+}
+#endif
@@ -0,0 +1,365 @@
+//
+//  git_password.h
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef GIT_PASSWORD_H
+#define GIT_PASSWORD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+// What goes into the binary, each on unless the build sets it to 0. Without
+// GIT_PASSWORD_WITH_KEYCHAIN nothing refers to CoreFoundation or Security and
+// the injected map is the only source; without GIT_PASSWORD_WITH_DAEMON there
+// is no cache process to ask; without GIT_PASSWORD_WITH_ANCESTRY the parent
+// processes are never walked, so any caller is answered and the remote comes
+// from the prompt or remote.origin.url. The WITH_ keeps them apart from the
+// GIT_PASSWORD_* environment variables.
+#ifndef GIT_PASSWORD_WITH_KEYCHAIN
+#define GIT_PASSWORD_WITH_KEYCHAIN 1
+#endif
+#ifndef GIT_PASSWORD_WITH_DAEMON
+#define GIT_PASSWORD_WITH_DAEMON 1
+#endif
+#ifndef GIT_PASSWORD_WITH_ANCESTRY
+#define GIT_PASSWORD_WITH_ANCESTRY 1
+#endif
+
+#if GIT_PASSWORD_WITH_KEYCHAIN
+#include <CoreFoundation/CoreFoundation.h>
+#include <Security/SecBase.h>
+#include <Security/SecItem.h>
+#include <Security/SecKeychain.h>
+#else
+// The few Security types and result codes the rest of the code speaks in.
+typedef int32_t OSStatus;
+typedef uint32_t UInt32;
+enum
+{
+	errSecSuccess = 0,
+	errSecUnimplemented = -4,
+	errSecIO = -36,
+	errSecParam = -50,
+	errSecAllocate = -108,
+	errSecUserCanceled = -128,
+	errSecNotAvailable = -25291,
+	errSecDuplicateItem = -25299,
+	errSecItemNotFound = -25300
+};
+#endif
+
+// expires is the password_expiry_utc git knows from the credential protocol, or
+// 0 for a password that does not expire.
+struct KeyChainItem
+{
+	char * username;
+	char * password;
+	time_t expires;
+};
+typedef struct KeyChainItem KeyChainItem;
+
+struct Credential
+{
+	char * protocol;
+	char * host;
+	char * path;
+	char * url;
+	char * username;
+	char * password;
+	char * password_expiry_utc;
+	char * quit;
+};
+typedef struct Credential Credential;
+
+// A credential store. Operations report errSecItemNotFound for a repository the
+// store does not hold, errSecUserCanceled for one that was declined, and
+// errSecUnimplemented for an operation the store does not support. reveal may be
+// NULL; where set it writes the password to fd without copying it.
+struct Backend
+{
+	const char * name;
+	OSStatus (* lookup)(struct Backend * self, char * repository, bool include_password, KeyChainItem ** result, FILE * terminal);
+	OSStatus (* reveal)(struct Backend * self, char * repository, int fd, FILE * terminal);
+	OSStatus (* store)(struct Backend * self, char * repository, char * username, char * password, time_t expires, FILE * terminal);
+	OSStatus (* erase)(struct Backend * self, char * repository, char * username, FILE * terminal);
+	void (* close)(struct Backend * self);
+	void * state;
+};
+typedef struct Backend Backend;
+
+#if GIT_PASSWORD_WITH_KEYCHAIN
+// Entry points of CoreFoundation and Security, resolved with dlsym by security.c.
+struct SecurityApi
+{
+	__typeof__(&CFArrayCreate) CFArrayCreate;
+	__typeof__(&CFArrayGetCount) CFArrayGetCount;
+	__typeof__(&CFArrayGetValueAtIndex) CFArrayGetValueAtIndex;
+	__typeof__(&CFDataGetBytePtr) CFDataGetBytePtr;
+	__typeof__(&CFDataGetLength) CFDataGetLength;
+	__typeof__(&CFDictionaryCreateMutable) CFDictionaryCreateMutable;
+	__typeof__(&CFDictionaryGetValue) CFDictionaryGetValue;
+	__typeof__(&CFDictionarySetValue) CFDictionarySetValue;
+	__typeof__(&CFRelease) CFRelease;
+	__typeof__(&CFRunLoopRun) CFRunLoopRun;
+	__typeof__(&CFStringCreateWithCString) CFStringCreateWithCString;
+	__typeof__(&CFStringGetCString) CFStringGetCString;
+	__typeof__(&CFStringGetLength) CFStringGetLength;
+	__typeof__(&CFStringGetMaximumSizeForEncoding) CFStringGetMaximumSizeForEncoding;
+	const CFArrayCallBacks * kCFTypeArrayCallBacks;
+	const CFDictionaryKeyCallBacks * kCFTypeDictionaryKeyCallBacks;
+	const CFDictionaryValueCallBacks * kCFTypeDictionaryValueCallBacks;
+	CFBooleanRef kCFBooleanTrue;
+
+	__typeof__(&SecCopyErrorMessageString) SecCopyErrorMessageString;
+	__typeof__(&SecItemCopyMatching) SecItemCopyMatching;
+	__typeof__(&SecKeychainAddCallback) SecKeychainAddCallback;
+	__typeof__(&SecKeychainAttributeInfoForItemID) SecKeychainAttributeInfoForItemID;
+	__typeof__(&SecKeychainCreate) SecKeychainCreate;
+	__typeof__(&SecKeychainDelete) SecKeychainDelete;
+	__typeof__(&SecKeychainFindGenericPassword) SecKeychainFindGenericPassword;
+	__typeof__(&SecKeychainFreeAttributeInfo) SecKeychainFreeAttributeInfo;
+	__typeof__(&SecKeychainItemCopyAttributesAndData) SecKeychainItemCopyAttributesAndData;
+	__typeof__(&SecKeychainItemCopyContent) SecKeychainItemCopyContent;
+	__typeof__(&SecKeychainItemCreateFromContent) SecKeychainItemCreateFromContent;
+	__typeof__(&SecKeychainItemDelete) SecKeychainItemDelete;
+	__typeof__(&SecKeychainItemFreeAttributesAndData) SecKeychainItemFreeAttributesAndData;
+	__typeof__(&SecKeychainItemFreeContent) SecKeychainItemFreeContent;
+	__typeof__(&SecKeychainItemModifyAttributesAndData) SecKeychainItemModifyAttributesAndData;
+	__typeof__(&SecKeychainOpen) SecKeychainOpen;
+	CFStringRef kSecAttrAccount;
+	CFStringRef kSecAttrComment;
+	CFStringRef kSecAttrDescription;
+	CFStringRef kSecAttrService;
+	CFStringRef kSecClass;
+	CFStringRef kSecClassGenericPassword;
+	CFStringRef kSecMatchLimit;
+	CFStringRef kSecMatchLimitAll;
+	CFStringRef kSecMatchLimitOne;
+	CFStringRef kSecMatchSearchList;
+	CFStringRef kSecReturnAttributes;
+	CFStringRef kSecReturnData;
+	CFStringRef kSecReturnRef;
+	CFStringRef kSecValueData;
+	CFStringRef kSecValueRef;
+};
+#endif
+typedef struct SecurityApi SecurityApi;
+
+// git-password.* settings as they apply to one remote, see options.c.
+struct Options
+{
+	const char * keychain;
+	int cache_ttl;
+	int negative_ttl;
+	bool negative_on_disk;
+	bool use_http_path;
+	bool interactive;
+	int prompt_timeout;
+	const char * trace;
+	const char * refresh_command;
+	int refresh_ahead;
+};
+typedef struct Options Options;
+
+struct RemoteUrl
+{
+	char * scheme;
+	char * host;
+	int port;
+	char * path;
+};
+typedef struct RemoteUrl RemoteUrl;
+
+enum PromptKind
+{
+	PROMPT_USERNAME,
+	PROMPT_PASSWORD
+};
+
+enum StatEvent
+{
+	STAT_HIT,
+	STAT_MISS,
+	STAT_NEGATIVE_HIT,
+	STAT_KEYCHAIN_LOOKUP,
+	STAT_PROMPT,
+	STAT_KEYCHAIN_STORE,
+	STAT_INVALIDATION,
+	STAT_EVENTS
+};
+
+struct Prompt
+{
+	enum PromptKind kind;
+	char * url;
+};
+typedef struct Prompt Prompt;
+
+// Where the ancestry check reads processes from: the kernel, or for the bench a
+// synthetic table. lookup reports whether pid exists; snapshot hands back a
+// malloc'd copy of the whole table, as KERN_PROC_ALL does.
+struct kinfo_proc;
+struct ProcessSource
+{
+	bool (* lookup)(struct ProcessSource * self, pid_t pid, struct kinfo_proc * info);
+	bool (* snapshot)(struct ProcessSource * self, struct kinfo_proc ** table, size_t * count);
+	void * state;
+};
+typedef struct ProcessSource ProcessSource;
+
+// util.c
+void fatal(const char * message, FILE * terminal);
+UInt32 len(const char * string);
+char * trim_trailing_whitespace(char * string);
+uint64_t hash_string(const char * string);
+double now_seconds(void);
+const char * find_runtime_directory(const char ** problem);
+const char * runtime_directory(FILE * terminal);
+char * copy_bytes(const void * data, UInt32 length);
+bool write_all(int fd, const void * data, size_t length);
+bool write_attribute(int fd, const char * name, const char * value);
+
+// arena.c
+void * arena_alloc(size_t size, FILE * terminal);
+char * arena_copy(const void * data, size_t length, FILE * terminal);
+char * arena_printf(FILE * terminal, const char * format, ...);
+void arena_reset(void);
+
+// secret.c
+void * secret_alloc(size_t size);
+void secret_free(void * pointer);
+
+// trace.c
+void trace_thread(const char * name);
+double trace_enter(const char * label);
+void trace_leave(const char * label, double started);
+
+// ancestry.c
+int is_git_calling_us(FILE * terminal);
+int ancestry_check(ProcessSource * source, pid_t pid, int ttl, FILE * terminal);
+int ancestry_scan(ProcessSource * source, pid_t pid);
+char * remote_helper_url(FILE * terminal);
+
+// config.c
+const char * config_get(const char * key, FILE * terminal);
+void config_each(void (* visit)(const char * key, const char * value, void * context), void * context, FILE * terminal);
+char * git_config(char * key, FILE * terminal);
+char * git_origin_url(FILE * terminal);
+bool config_bool(const char * value);
+
+// options.c
+Options git_password_options(const char * url, FILE * terminal);
+
+// security.c
+const SecurityApi * security_api(void);
+void security(OSStatus status, FILE * terminal);
+
+// backend.c
+Backend * memory_backend(void);
+Backend * chain_backend(Backend ** layers, size_t count);
+Backend * source_backend(FILE * terminal);
+Backend * credential_backend(FILE * terminal);
+
+// injected.c
+bool injected_credentials(FILE * terminal);
+Backend * injected_backend(void);
+
+// keychain.c
+OSStatus copy_keychain_item(char * repository, bool include_password, KeyChainItem ** result);
+OSStatus write_keychain_password(char * repository, int fd, time_t valid_until, bool * expiring);
+KeyChainItem * find_keychain_item(char * repository, bool include_password, FILE * terminal);
+OSStatus store_keychain_item(char * repository, char * username, char * password, time_t expires);
+void create_keychain_item(char * repository, char * username, char * password, time_t expires, FILE * terminal);
+OSStatus erase_keychain_item(char * repository, char * username);
+void delete_keychain_item(char * repository, char * username, FILE * terminal);
+OSStatus each_keychain_item(void (* visit)(const char * repository, KeyChainItem * item, void * context), void * context);
+void free_keychain_item(KeyChainItem * item);
+KeyChainItem * copy_item(const KeyChainItem * item);
+bool watch_keychain(void (* changed)(const char * repository));
+void run_keychain_events(void);
+Backend * keychain_backend(void);
+
+// credential.c
+bool read_credential(Credential * credential, FILE * input);
+void free_credential(Credential * credential);
+char * credential_url(Credential * credential, FILE * terminal);
+time_t credential_expiry(const Credential * credential);
+void write_credential_item(int fd, const KeyChainItem * item);
+void credential_helper(const char * action, FILE * terminal);
+bool is_credential_action(const char * argument);
+
+// daemon.c
+KeyChainItem * daemon_lookup(char * repository, bool * declined, FILE * terminal);
+void daemon_decline(char * repository, FILE * terminal);
+bool daemon_forget(char * repository, FILE * terminal);
+int daemon_warm(char ** repositories, KeyChainItem ** items, size_t count, int ttl, FILE * terminal);
+void daemon_report(const char * reports);
+bool daemon_stats(int fd, bool json, FILE * terminal);
+Backend * daemon_backend(void);
+void run_daemon(int argc, const char * argv[], FILE * terminal);
+
+// negative.c
+bool negative_cache_hit(const char * repository, FILE * terminal);
+void negative_cache_store(char * repository, FILE * terminal);
+void negative_cache_clear(const char * repository, FILE * terminal);
+Backend * negative_backend(void);
+
+// stats.c
+void stats_serve(void);
+void stats_record(enum StatEvent event, double seconds, OSStatus status);
+void stats_report(const char * report);
+void stats_write(int fd, bool json);
+void run_stats(int argc, const char * argv[], FILE * terminal);
+
+// refresh.c
+bool refresh_due(const char * repository, time_t expires);
+KeyChainItem * refresh_credentials(char * repository, const char * username, FILE * terminal);
+
+// transfer.c
+void run_import(int argc, const char * argv[], FILE * terminal);
+void run_export(int argc, const char * argv[], FILE * terminal);
+
+// warm.c
+void run_warm(int argc, const char * argv[], FILE * terminal);
+
+// resolve.c
+void run_resolve(int argc, const char * argv[], FILE * terminal);
+
+// askpass.c
+KeyChainItem * lookup_keychain_item(char * repository, bool include_password, bool * declined, FILE * terminal);
+char * prompt(char * prompt, int timeout, FILE * terminal);
+bool parse_prompt(const char * argument, Prompt * result, FILE * terminal);
+void get_username(char * url, int fd, FILE * terminal);
+void get_password(char * url, int fd, FILE * terminal);
+
+// url.c
+bool parse_remote_url(const char * url, RemoteUrl * result, FILE * terminal);
+void free_remote_url(RemoteUrl * url);
+char * rewrite_url(const char * url, FILE * terminal);
+char * rewrite_push_url(const char * url, FILE * terminal);
+char * canonical_repository(const char * url, FILE * terminal);
+
+#endif
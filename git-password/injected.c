@@ -0,0 +1,234 @@
+//
+//  injected.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+#define INJECTED_MAX_SIZE (1 << 20)
+
+// One url=/username=/password= block per repository; the strings point into
+// the locked buffer the map was read into.
+struct InjectedEntry
+{
+	char * repository;
+	char * username;
+	char * password;
+};
+typedef struct InjectedEntry InjectedEntry;
+
+static struct
+{
+	bool loaded;
+	bool enabled;
+	char * buffer;
+	size_t size;
+	InjectedEntry * entries;
+	size_t count;
+} injected;
+
+static char * locked_buffer(size_t size, FILE * terminal)
+{
+	char * buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+
+	if (buffer == MAP_FAILED)
+		fatal("unable to allocate memory", terminal);
+	if (mlock(buffer, size) != 0)
+		fatal("unable to lock injected credentials in memory", terminal);
+
+	return buffer;
+}
+
+static void release_buffer(char * buffer, size_t size)
+{
+	memset(buffer, 0, size);
+	munlock(buffer, size);
+	munmap(buffer, size);
+}
+
+// A regular file is read from the start in every process; a pipe or fifo
+// only yields the map once, so it is meant to be handed to the daemon.
+static void read_injected(int fd, FILE * terminal)
+{
+	size_t capacity = getpagesize(), length = 0;
+	char * buffer = locked_buffer(capacity, terminal), * grown;
+	ssize_t count;
+
+	lseek(fd, 0, SEEK_SET);
+	while ((count = read(fd, buffer + length, capacity - length - 1)) != 0)
+	{
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+			fatal("unable to read injected credentials", terminal);
+		if ((length += count) < capacity - 1)
+			continue;
+		if (capacity * 2 > INJECTED_MAX_SIZE)
+			fatal("injected credentials are too large", terminal);
+
+		grown = locked_buffer(capacity * 2, terminal);
+		memcpy(grown, buffer, length);
+		release_buffer(buffer, capacity);
+		buffer = grown;
+		capacity *= 2;
+	}
+
+	buffer[length] = 0;
+	injected.buffer = buffer;
+	injected.size = capacity;
+}
+
+static void parse_injected(FILE * terminal)
+{
+	InjectedEntry entry = { NULL, NULL, NULL };
+	size_t capacity = 0;
+	char * line = injected.buffer, * next, * value;
+
+	for (; line; line = next)
+	{
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = 0;
+
+		if (*line && (value = strchr(line, '=')) != NULL)
+		{
+			*value++ = 0;
+			if (strcmp(line, "url") == 0)
+				entry.repository = value;
+			else if (strcmp(line, "username") == 0)
+				entry.username = value;
+			else if (strcmp(line, "password") == 0)
+				entry.password = value;
+			if (next)
+				continue;
+		}
+		else if (*line)
+			fatal("malformed injected credential attribute", terminal);
+
+		if (!entry.repository || !entry.username || !entry.password)
+		{
+			entry.repository = entry.username = entry.password = NULL;
+			continue;
+		}
+
+		if (injected.count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 8;
+			if ((injected.entries = realloc(injected.entries, capacity * sizeof(InjectedEntry))) == NULL)
+				fatal("unable to allocate memory", terminal);
+		}
+		if ((entry.repository = strdup(canonical_repository(entry.repository, terminal))) == NULL)
+			fatal("unable to allocate memory", terminal);
+		injected.entries[injected.count++] = entry;
+		entry.repository = entry.username = entry.password = NULL;
+	}
+}
+
+// GIT_PASSWORD_CREDENTIALS is an inherited file descriptor number or the path of
+// a file or named pipe; when it is set the map replaces the keychain.
+bool injected_credentials(FILE * terminal)
+{
+	const char * source = getenv("GIT_PASSWORD_CREDENTIALS");
+	char * end;
+	long number;
+	int fd;
+
+	if (injected.loaded)
+		return injected.enabled;
+
+	injected.loaded = true;
+	if (!source || !*source)
+		return false;
+
+	number = strtol(source, &end, 10);
+	if (*end == 0 && number >= 0)
+		fd = (int)number;
+	else if ((fd = open(source, O_RDONLY)) < 0)
+		fatal("unable to open injected credentials", terminal);
+
+	injected.enabled = true;
+	read_injected(fd, terminal);
+	if (*end != 0)
+		close(fd);
+	parse_injected(terminal);
+
+	return true;
+}
+
+static OSStatus injected_lookup(Backend * self, char * repository, bool include_password, KeyChainItem ** result, FILE * terminal)
+{
+	*result = NULL;
+
+	for (size_t i = 0; i < injected.count; i++)
+	{
+		KeyChainItem entry = { .username = injected.entries[i].username, .password = include_password ? injected.entries[i].password : NULL, .expires = 0 };
+
+		if (strcmp(injected.entries[i].repository, repository) == 0)
+			return (*result = copy_item(&entry)) ? errSecSuccess : errSecAllocate;
+	}
+
+	return errSecItemNotFound;
+}
+
+// Passwords are written straight out of the locked buffer.
+static OSStatus injected_reveal(Backend * self, char * repository, int fd, FILE * terminal)
+{
+	for (size_t i = 0; i < injected.count; i++)
+		if (strcmp(injected.entries[i].repository, repository) == 0)
+			return write_all(fd, injected.entries[i].password, strlen(injected.entries[i].password)) ? errSecSuccess : errSecIO;
+
+	return errSecItemNotFound;
+}
+
+// The map is read-only; storing and erasing leave it alone.
+static OSStatus injected_store(Backend * self, char * repository, char * username, char * password, time_t expires, FILE * terminal)
+{
+	return errSecUnimplemented;
+}
+
+static OSStatus injected_erase(Backend * self, char * repository, char * username, FILE * terminal)
+{
+	return errSecUnimplemented;
+}
+
+static void injected_close(Backend * self)
+{
+	if (injected.buffer)
+		release_buffer(injected.buffer, injected.size);
+	for (size_t i = 0; i < injected.count; i++)
+		free(injected.entries[i].repository);
+	free(injected.entries);
+	memset(&injected, 0, sizeof(injected));
+}
+
+Backend * injected_backend(void)
+{
+	static Backend backend = { "injected", injected_lookup, injected_reveal, injected_store, injected_erase, injected_close, NULL };
+
+	return &backend;
+}
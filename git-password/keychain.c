@@ -0,0 +1,689 @@
+//
+//  keychain.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+#define KEYCHAIN_EXPIRY_PREFIX "password_expiry_utc="
+
+#if GIT_PASSWORD_WITH_KEYCHAIN
+// git-password.keychain (or GIT_PASSWORD_KEYCHAIN) names the keychain for a
+// repository; unset means the default search list. Keychains are opened once and
+// kept for the life of the process, which is shared by the daemon's workers.
+struct OpenedKeychain
+{
+	char * name;
+	SecKeychainRef keychain;
+	struct OpenedKeychain * next;
+};
+typedef struct OpenedKeychain OpenedKeychain;
+
+static SecKeychainRef configured_keychain(const char * repository)
+{
+	static OpenedKeychain * opened = NULL;
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	const SecurityApi * api = security_api();
+	const char * name = git_password_options(repository, stderr).keychain;
+	OpenedKeychain * entry;
+
+	if (!api || !name || !*name)
+		return NULL;
+
+	pthread_mutex_lock(&lock);
+	for (entry = opened; entry && strcmp(entry->name, name) != 0; entry = entry->next)
+		;
+	if (!entry && (entry = calloc(1, sizeof(OpenedKeychain))) != NULL)
+	{
+		if ((entry->name = strdup(name)) == NULL)
+		{
+			free(entry);
+			entry = NULL;
+		}
+		else
+		{
+			if (api->SecKeychainOpen(name, &entry->keychain) != errSecSuccess)
+				entry->keychain = NULL;
+			entry->next = opened;
+			opened = entry;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	return entry ? entry->keychain : NULL;
+}
+
+static char * copy_cfstring(CFStringRef string)
+{
+	const SecurityApi * api = security_api();
+	CFIndex size = api->CFStringGetMaximumSizeForEncoding(api->CFStringGetLength(string), kCFStringEncodingUTF8) + 1;
+	char * result = malloc(size);
+
+	if (result && !api->CFStringGetCString(string, result, size, kCFStringEncodingUTF8))
+		*result = 0;
+
+	return result;
+}
+
+// Account and secret come back from securityd in one SecItemCopyMatching round trip.
+static OSStatus match_keychain_item(char * repository, bool include_password, CFDictionaryRef * match)
+{
+	const SecurityApi * api = security_api();
+	CFMutableDictionaryRef query = api->CFDictionaryCreateMutable(NULL, 0, api->kCFTypeDictionaryKeyCallBacks, api->kCFTypeDictionaryValueCallBacks);
+	CFStringRef service = api->CFStringCreateWithCString(NULL, repository, kCFStringEncodingUTF8);
+	SecKeychainRef keychain = configured_keychain(repository);
+	CFArrayRef search_list = NULL;
+	OSStatus status;
+
+	api->CFDictionarySetValue(query, api->kSecClass, api->kSecClassGenericPassword);
+	api->CFDictionarySetValue(query, api->kSecAttrService, service);
+	api->CFDictionarySetValue(query, api->kSecReturnAttributes, api->kCFBooleanTrue);
+	api->CFDictionarySetValue(query, api->kSecMatchLimit, api->kSecMatchLimitOne);
+	if (include_password)
+		api->CFDictionarySetValue(query, api->kSecReturnData, api->kCFBooleanTrue);
+	if (keychain)
+	{
+		search_list = api->CFArrayCreate(NULL, (const void **)&keychain, 1, api->kCFTypeArrayCallBacks);
+		api->CFDictionarySetValue(query, api->kSecMatchSearchList, search_list);
+	}
+
+	*match = NULL;
+	status = api->SecItemCopyMatching(query, (CFTypeRef *)match);
+
+	if (search_list)
+		api->CFRelease(search_list);
+	api->CFRelease(service);
+	api->CFRelease(query);
+
+	return status;
+}
+
+// An expiry travels in the item's comment as "password_expiry_utc=<seconds>",
+// the way the credential protocol spells it.
+static time_t comment_expiry(const void * comment, size_t length)
+{
+	size_t prefix = strlen(KEYCHAIN_EXPIRY_PREFIX);
+	char digits[24];
+
+	if (!comment || length <= prefix || length - prefix >= sizeof(digits) || memcmp(comment, KEYCHAIN_EXPIRY_PREFIX, prefix) != 0)
+		return 0;
+
+	memcpy(digits, (const char *)comment + prefix, length - prefix);
+	digits[length - prefix] = 0;
+
+	return (time_t)strtoll(digits, NULL, 10);
+}
+
+static time_t match_expiry(CFDictionaryRef match)
+{
+	CFStringRef comment = security_api()->CFDictionaryGetValue(match, security_api()->kSecAttrComment);
+	char * text = comment ? copy_cfstring(comment) : NULL;
+	time_t expires = text ? comment_expiry(text, strlen(text)) : 0;
+
+	free(text);
+
+	return expires;
+}
+
+static OSStatus copy_keychain_item_matching(char * repository, bool include_password, KeyChainItem ** result)
+{
+	const SecurityApi * api = security_api();
+	CFDictionaryRef match;
+	OSStatus status;
+
+	if ((status = match_keychain_item(repository, include_password, &match)) == errSecSuccess)
+	{
+		CFStringRef account = api->CFDictionaryGetValue(match, api->kSecAttrAccount);
+		CFDataRef data = include_password ? api->CFDictionaryGetValue(match, api->kSecValueData) : NULL;
+
+		*result = calloc(1, sizeof(KeyChainItem));
+		(*result)->username = account ? copy_cfstring(account) : copy_bytes("", 0);
+		if (include_password)
+			(*result)->password = data ? copy_bytes(api->CFDataGetBytePtr(data), (UInt32)api->CFDataGetLength(data)) : copy_bytes("", 0);
+		(*result)->expires = match_expiry(match);
+
+		api->CFRelease(match);
+	}
+
+	return status;
+}
+
+// Attributes and, when asked for, the secret of an item, in buffers the caller
+// hands back with SecKeychainItemFreeAttributesAndData.
+static OSStatus copy_legacy_content(char * repository, SecKeychainAttributeList ** attributes, UInt32 * password_length, void ** password)
+{
+	const SecurityApi * api = security_api();
+	SecKeychainItemRef item;
+	SecKeychainAttributeInfo * info;
+	OSStatus status;
+
+	if ((status = api->SecKeychainFindGenericPassword(configured_keychain(repository), len(repository), repository, 0, NULL, NULL, NULL, &item)) != errSecSuccess)
+		return status;
+
+	if ((status = api->SecKeychainAttributeInfoForItemID(NULL, CSSM_DL_DB_RECORD_GENERIC_PASSWORD, &info)) == errSecSuccess)
+	{
+		status = api->SecKeychainItemCopyAttributesAndData(item, info, NULL, attributes, password_length, password);
+		api->SecKeychainFreeAttributeInfo(info);
+	}
+
+	api->CFRelease(item);
+
+	return status;
+}
+
+static time_t legacy_expiry(SecKeychainAttributeList * attributes)
+{
+	for (int i = 0; i < attributes->count; i++)
+		if (attributes->attr[i].tag == kSecCommentItemAttr)
+			return comment_expiry(attributes->attr[i].data, attributes->attr[i].length);
+
+	return 0;
+}
+
+static OSStatus copy_keychain_item_legacy(char * repository, bool include_password, KeyChainItem ** result)
+{
+	const SecurityApi * api = security_api();
+	SecKeychainAttributeList * attributes;
+	void * password = NULL;
+	UInt32 password_length = 0;
+	OSStatus status;
+
+	*result = NULL;
+
+	if (include_password)
+		status = copy_legacy_content(repository, &attributes, &password_length, &password);
+	else
+		status = copy_legacy_content(repository, &attributes, NULL, NULL);
+
+	if (status == errSecSuccess)
+	{
+		*result = calloc(1, sizeof(KeyChainItem));
+
+		for (int i = 0; i < attributes->count; i++)
+		{
+			SecKeychainAttribute attribute = attributes->attr[i];
+
+			if (attribute.tag == kSecAccountItemAttr)
+				(*result)->username = copy_bytes(attribute.data, attribute.length);
+		}
+
+		if (!(*result)->username)
+			(*result)->username = copy_bytes("", 0);
+		if (include_password)
+			(*result)->password = copy_bytes(password, password_length);
+		(*result)->expires = legacy_expiry(attributes);
+
+		api->SecKeychainItemFreeAttributesAndData(attributes, password);
+	}
+
+	return status;
+}
+
+OSStatus copy_keychain_item(char * repository, bool include_password, KeyChainItem ** result)
+{
+	OSStatus status;
+
+	*result = NULL;
+	if (!security_api())
+		return errSecNotAvailable;
+
+	status = copy_keychain_item_matching(repository, include_password, result);
+
+	if (status == errSecUnimplemented || status == errSecParam)
+		status = copy_keychain_item_legacy(repository, include_password, result);
+
+	return status;
+}
+
+// The secret goes from the buffer Security hands back straight to fd and is
+// released right after, so no copy of it is ever made in this process. An item
+// that expires before valid_until is not written; *expiring tells the caller to
+// take the slow path, which can renew it.
+OSStatus write_keychain_password(char * repository, int fd, time_t valid_until, bool * expiring)
+{
+	const SecurityApi * api = security_api();
+	CFDictionaryRef match;
+	CFDataRef data;
+	SecKeychainAttributeList * attributes;
+	void * password;
+	UInt32 length;
+	time_t expires;
+	OSStatus status;
+
+	*expiring = false;
+	if (!api)
+		return errSecNotAvailable;
+
+	if ((status = match_keychain_item(repository, true, &match)) == errSecSuccess)
+	{
+		if ((expires = match_expiry(match)) && expires < valid_until)
+			*expiring = true;
+		else if ((data = api->CFDictionaryGetValue(match, api->kSecValueData)) && !write_all(fd, api->CFDataGetBytePtr(data), api->CFDataGetLength(data)))
+			status = errSecIO;
+		api->CFRelease(match);
+	}
+	else if ((status == errSecUnimplemented || status == errSecParam) && (status = copy_legacy_content(repository, &attributes, &length, &password)) == errSecSuccess)
+	{
+		if ((expires = legacy_expiry(attributes)) && expires < valid_until)
+			*expiring = true;
+		else if (!write_all(fd, password, length))
+			status = errSecIO;
+		api->SecKeychainItemFreeAttributesAndData(attributes, password);
+	}
+
+	return *expiring ? errSecItemNotFound : status;
+}
+
+static bool keychain_item_matches(char * repository, char * username, char * password, time_t expires)
+{
+	KeyChainItem * existing;
+	bool matches;
+
+	if (copy_keychain_item(repository, true, &existing) != errSecSuccess)
+		return false;
+
+	matches = strcmp(existing->username, username) == 0 && existing->password && strcmp(existing->password, password) == 0 && existing->expires == expires;
+	free_keychain_item(existing);
+
+	return matches;
+}
+
+OSStatus store_keychain_item(char * repository, char * username, char * password, time_t expires)
+{
+	const SecurityApi * api = security_api();
+	SecItemClass class = kSecGenericPasswordItemClass;
+	char comment[64] = "";
+	SecKeychainAttribute attributes[] =
+	{
+		{ kSecLabelItemAttr, len(repository), repository },
+		{ kSecDescriptionItemAttr, 23, "git repository password" },
+		{ kSecAccountItemAttr, len(username), username },
+		{ kSecCommentItemAttr, 0, comment },
+		{ kSecServiceItemAttr, len(repository), repository }
+	};
+	SecKeychainAttributeList attribute_list = { 5, attributes };
+	SecKeychainAttributeList account = { 2, &attributes[2] };
+	SecKeychainItemRef item;
+	double started = now_seconds();
+	OSStatus status;
+
+	if (!api)
+		return errSecNotAvailable;
+	if (expires > 0)
+		attributes[3].length = snprintf(comment, sizeof(comment), KEYCHAIN_EXPIRY_PREFIX "%lld", (long long)expires);
+
+	status = api->SecKeychainItemCreateFromContent(class, &attribute_list, len(password), password, configured_keychain(repository), NULL, NULL);
+
+	// git stores again after every authentication it made with these very
+	// credentials; leaving the item alone then spares the daemon a change event
+	// that would drop its cached copy. Otherwise another process stored the same
+	// repository first, or a refresh replaces the secret; update it in place.
+	if (status == errSecDuplicateItem && keychain_item_matches(repository, username, password, expires))
+		status = errSecSuccess;
+	else if (status == errSecDuplicateItem)
+	{
+		if ((status = api->SecKeychainFindGenericPassword(configured_keychain(repository), len(repository), repository, 0, NULL, NULL, NULL, &item)) == errSecSuccess)
+		{
+			status = api->SecKeychainItemModifyAttributesAndData(item, &account, len(password), password);
+			api->CFRelease(item);
+		}
+	}
+	stats_record(STAT_KEYCHAIN_STORE, now_seconds() - started, status);
+
+	return status;
+}
+
+// With a username only the item for that account is removed.
+OSStatus erase_keychain_item(char * repository, char * username)
+{
+	const SecurityApi * api = security_api();
+	SecKeychainItemRef item;
+	KeyChainItem * existing;
+	OSStatus status;
+
+	if (username && *username)
+	{
+		if ((status = copy_keychain_item(repository, false, &existing)) != errSecSuccess)
+			return status;
+		status = strcmp(existing->username, username) == 0 ? errSecSuccess : errSecItemNotFound;
+		free_keychain_item(existing);
+		if (status != errSecSuccess)
+			return status;
+	}
+
+	if (!api)
+		return errSecNotAvailable;
+	if ((status = api->SecKeychainFindGenericPassword(configured_keychain(repository), len(repository), repository, 0, NULL, NULL, NULL, &item)) != errSecSuccess)
+		return status;
+
+	status = api->SecKeychainItemDelete(item);
+	api->CFRelease(item);
+
+	return status;
+}
+
+// Every item git-password created, found by its description in one query; the
+// secrets are then read item by item, since they cannot be returned in bulk.
+OSStatus each_keychain_item(void (* visit)(const char * repository, KeyChainItem * item, void * context), void * context)
+{
+	const SecurityApi * api = security_api();
+	CFMutableDictionaryRef query;
+	CFStringRef description;
+	SecKeychainRef keychain;
+	CFArrayRef search_list = NULL, matches = NULL;
+	OSStatus status;
+
+	if (!api)
+		return errSecNotAvailable;
+
+	query = api->CFDictionaryCreateMutable(NULL, 0, api->kCFTypeDictionaryKeyCallBacks, api->kCFTypeDictionaryValueCallBacks);
+	description = api->CFStringCreateWithCString(NULL, "git repository password", kCFStringEncodingUTF8);
+	api->CFDictionarySetValue(query, api->kSecClass, api->kSecClassGenericPassword);
+	api->CFDictionarySetValue(query, api->kSecAttrDescription, description);
+	api->CFDictionarySetValue(query, api->kSecReturnAttributes, api->kCFBooleanTrue);
+	api->CFDictionarySetValue(query, api->kSecReturnRef, api->kCFBooleanTrue);
+	api->CFDictionarySetValue(query, api->kSecMatchLimit, api->kSecMatchLimitAll);
+	if ((keychain = configured_keychain(NULL)) != NULL)
+	{
+		search_list = api->CFArrayCreate(NULL, (const void **)&keychain, 1, api->kCFTypeArrayCallBacks);
+		api->CFDictionarySetValue(query, api->kSecMatchSearchList, search_list);
+	}
+
+	if ((status = api->SecItemCopyMatching(query, (CFTypeRef *)&matches)) == errSecSuccess)
+	{
+		for (CFIndex i = 0, count = api->CFArrayGetCount(matches); i < count && status == errSecSuccess; i++)
+		{
+			CFDictionaryRef match = api->CFArrayGetValueAtIndex(matches, i);
+			CFStringRef service = api->CFDictionaryGetValue(match, api->kSecAttrService);
+			CFStringRef account = api->CFDictionaryGetValue(match, api->kSecAttrAccount);
+			SecKeychainItemRef reference = (SecKeychainItemRef)api->CFDictionaryGetValue(match, api->kSecValueRef);
+			KeyChainItem item = { NULL, NULL, match_expiry(match) };
+			char * repository;
+			void * data;
+			UInt32 length;
+
+			if (!service || !reference)
+				continue;
+			if ((status = api->SecKeychainItemCopyContent(reference, NULL, NULL, &length, &data)) != errSecSuccess)
+				break;
+
+			repository = copy_cfstring(service);
+			item.username = account ? copy_cfstring(account) : copy_bytes("", 0);
+			item.password = copy_bytes(data, length);
+			api->SecKeychainItemFreeContent(NULL, data);
+			if (repository && item.username && item.password)
+				visit(repository, &item, context);
+			else
+				status = errSecAllocate;
+
+			if (item.password)
+				memset(item.password, 0, length);
+			free(repository);
+			free(item.username);
+			free(item.password);
+		}
+		api->CFRelease(matches);
+	}
+	else if (status == errSecItemNotFound)
+		status = errSecSuccess;
+
+	if (search_list)
+		api->CFRelease(search_list);
+	api->CFRelease(description);
+	api->CFRelease(query);
+
+	return status;
+}
+
+static void (* keychain_changed)(const char * repository);
+
+// Only the service of the item is read, which needs no access to its secret. A
+// deleted item may not be readable any more; without its service any repository
+// could be the one affected. What this process stored itself is already cached.
+static OSStatus keychain_event(SecKeychainEvent event, SecKeychainCallbackInfo * info, void * context)
+{
+	const SecurityApi * api = security_api();
+	SecKeychainAttribute service = { kSecServiceItemAttr, 0, NULL };
+	SecKeychainAttributeList attributes = { 1, &service };
+	SecItemClass class;
+	char * repository;
+
+	if (info->pid == getpid())
+		return errSecSuccess;
+	if (!info->item || api->SecKeychainItemCopyContent(info->item, &class, &attributes, NULL, NULL) != errSecSuccess)
+	{
+		keychain_changed(NULL);
+		return errSecSuccess;
+	}
+
+	if (class == kSecGenericPasswordItemClass)
+	{
+		repository = service.data ? copy_bytes(service.data, service.length) : NULL;
+		keychain_changed(repository);
+		free(repository);
+	}
+	api->SecKeychainItemFreeContent(&attributes, NULL);
+
+	return errSecSuccess;
+}
+
+// changed is called with the repository of every generic password another
+// process adds, modifies or deletes, or with NULL when that cannot be told.
+// Events arrive through the main thread's run loop, see run_keychain_events.
+bool watch_keychain(void (* changed)(const char * repository))
+{
+	const SecurityApi * api = security_api();
+
+	if (!api)
+		return false;
+	keychain_changed = changed;
+
+	return api->SecKeychainAddCallback(keychain_event, kSecAddEventMask | kSecUpdateEventMask | kSecDeleteEventMask, NULL) == errSecSuccess;
+}
+
+void run_keychain_events(void)
+{
+	security_api()->CFRunLoopRun();
+}
+#else
+OSStatus copy_keychain_item(char * repository, bool include_password, KeyChainItem ** result)
+{
+	*result = NULL;
+
+	return errSecNotAvailable;
+}
+
+OSStatus write_keychain_password(char * repository, int fd, time_t valid_until, bool * expiring)
+{
+	*expiring = false;
+
+	return errSecNotAvailable;
+}
+
+OSStatus store_keychain_item(char * repository, char * username, char * password, time_t expires)
+{
+	return errSecNotAvailable;
+}
+
+OSStatus erase_keychain_item(char * repository, char * username)
+{
+	return errSecNotAvailable;
+}
+
+OSStatus each_keychain_item(void (* visit)(const char * repository, KeyChainItem * item, void * context), void * context)
+{
+	return errSecNotAvailable;
+}
+
+bool watch_keychain(void (* changed)(const char * repository))
+{
+	return false;
+}
+
+void run_keychain_events(void)
+{
+}
+#endif
+
+KeyChainItem * find_keychain_item(char * repository, bool include_password, FILE * terminal)
+{
+	KeyChainItem * result;
+	double started = trace_enter("find_keychain_item");
+	OSStatus status = copy_keychain_item(repository, include_password, &result);
+
+	if (status != errSecSuccess && status != errSecItemNotFound)
+		security(status, terminal);
+
+	trace_leave("find_keychain_item", started);
+
+	return result;
+}
+
+void create_keychain_item(char * repository, char * username, char * password, time_t expires, FILE * terminal)
+{
+	double started = trace_enter("create_keychain_item");
+
+	security(store_keychain_item(repository, username, password, expires), terminal);
+	trace_leave("create_keychain_item", started);
+}
+
+void delete_keychain_item(char * repository, char * username, FILE * terminal)
+{
+	OSStatus status = erase_keychain_item(repository, username);
+
+	if (status != errSecItemNotFound)
+		security(status, terminal);
+}
+
+void free_keychain_item(KeyChainItem * item)
+{
+	if (!item)
+		return;
+	if (item->password)
+		memset(item->password, 0, strlen(item->password));
+
+	free(item->username);
+	free(item->password);
+	free(item);
+}
+
+KeyChainItem * copy_item(const KeyChainItem * item)
+{
+	KeyChainItem * result = calloc(1, sizeof(KeyChainItem));
+
+	if (!result)
+		return NULL;
+	if ((result->username = strdup(item->username)) == NULL || (item->password && (result->password = strdup(item->password)) == NULL))
+	{
+		free_keychain_item(result);
+		return NULL;
+	}
+	result->expires = item->expires;
+
+	return result;
+}
+
+// An item close to its expiry is renewed through the refresh command; one that
+// has expired and could not be renewed is as good as missing.
+static OSStatus keychain_lookup(Backend * self, char * repository, bool include_password, KeyChainItem ** result, FILE * terminal)
+{
+	double started = trace_enter("find_keychain_item");
+	OSStatus status = copy_keychain_item(repository, include_password, result);
+	KeyChainItem * renewed;
+
+	trace_leave("find_keychain_item", started);
+
+	if (status != errSecSuccess || !refresh_due(repository, (*result)->expires))
+		;
+	else if ((renewed = refresh_credentials(repository, (*result)->username, terminal)) != NULL)
+	{
+		free_keychain_item(*result);
+		if (!include_password)
+		{
+			memset(renewed->password, 0, strlen(renewed->password));
+			free(renewed->password);
+			renewed->password = NULL;
+		}
+		*result = renewed;
+	}
+
+	if (status == errSecSuccess && (*result)->expires && (*result)->expires <= time(NULL))
+	{
+		free_keychain_item(*result);
+		*result = NULL;
+		status = errSecItemNotFound;
+	}
+
+	return status;
+}
+
+static OSStatus keychain_reveal(Backend * self, char * repository, int fd, FILE * terminal)
+{
+	Options options = git_password_options(repository, terminal);
+	time_t valid_until = time(NULL) + (options.refresh_command ? options.refresh_ahead : 0);
+	double started = trace_enter("find_keychain_item");
+	bool expiring;
+	OSStatus status = write_keychain_password(repository, fd, valid_until, &expiring);
+	KeyChainItem * item;
+
+	trace_leave("find_keychain_item", started);
+
+	if (expiring && (status = keychain_lookup(self, repository, true, &item, terminal)) == errSecSuccess)
+	{
+		if (!write_all(fd, item->password, strlen(item->password)))
+			status = errSecIO;
+		free_keychain_item(item);
+	}
+
+	return status;
+}
+
+static OSStatus keychain_store(Backend * self, char * repository, char * username, char * password, time_t expires, FILE * terminal)
+{
+	double started = trace_enter("create_keychain_item");
+	OSStatus status = store_keychain_item(repository, username, password, expires);
+
+	trace_leave("create_keychain_item", started);
+
+	return status;
+}
+
+static OSStatus keychain_erase(Backend * self, char * repository, char * username, FILE * terminal)
+{
+	return erase_keychain_item(repository, username);
+}
+
+static void keychain_close(Backend * self)
+{
+}
+
+Backend * keychain_backend(void)
+{
+	static Backend backend = { "keychain", keychain_lookup, keychain_reveal, keychain_store, keychain_erase, keychain_close, NULL };
+
+	return &backend;
+}
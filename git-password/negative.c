@@ -0,0 +1,121 @@
+//
+//  negative.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+#define NEGATIVE_CACHE_DIRECTORY "Library/Caches/git-password"
+
+// With git-password.negativeOnDisk a declined repository is also remembered as
+// an empty file under ~/Library/Caches, so the window survives without a daemon.
+static char * negative_cache_path(const char * repository, bool create, FILE * terminal)
+{
+	const char * home = getenv("HOME");
+	char * directory;
+
+	if (!home || !*home)
+		return NULL;
+	directory = arena_printf(terminal, "%s/%s", home, NEGATIVE_CACHE_DIRECTORY);
+	if (create)
+		mkdir(directory, 0700);
+
+	return arena_printf(terminal, "%s/declined-%016llx", directory, (unsigned long long)hash_string(repository));
+}
+
+bool negative_cache_hit(const char * repository, FILE * terminal)
+{
+	Options options = git_password_options(repository, terminal);
+	struct stat info;
+	char * path;
+
+	if (options.negative_ttl <= 0 || !options.negative_on_disk || (path = negative_cache_path(repository, false, terminal)) == NULL)
+		return false;
+
+	return stat(path, &info) == 0 && time(NULL) - info.st_mtime < options.negative_ttl;
+}
+
+// The user gave no credentials for this repository; keep it from prompting again
+// for git-password.negativeTtl seconds.
+void negative_cache_store(char * repository, FILE * terminal)
+{
+	Options options = git_password_options(repository, terminal);
+	char * path;
+	int fd;
+
+	if (options.negative_ttl <= 0)
+		return;
+
+	daemon_decline(repository, terminal);
+
+	if (!options.negative_on_disk || (path = negative_cache_path(repository, true, terminal)) == NULL)
+		return;
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) >= 0)
+		close(fd);
+}
+
+void negative_cache_clear(const char * repository, FILE * terminal)
+{
+	char * path = negative_cache_path(repository, false, terminal);
+
+	if (path)
+		unlink(path);
+}
+
+static OSStatus negative_lookup(Backend * self, char * repository, bool include_password, KeyChainItem ** result, FILE * terminal)
+{
+	*result = NULL;
+
+	return negative_cache_hit(repository, terminal) ? errSecUserCanceled : errSecItemNotFound;
+}
+
+// Credentials stored or erased for a repository end the window at once.
+static OSStatus negative_store(Backend * self, char * repository, char * username, char * password, time_t expires, FILE * terminal)
+{
+	negative_cache_clear(repository, terminal);
+
+	return errSecSuccess;
+}
+
+static OSStatus negative_erase(Backend * self, char * repository, char * username, FILE * terminal)
+{
+	negative_cache_clear(repository, terminal);
+
+	return errSecSuccess;
+}
+
+static void negative_close(Backend * self)
+{
+}
+
+Backend * negative_backend(void)
+{
+	static Backend backend = { "negative", negative_lookup, NULL, negative_store, negative_erase, negative_close, NULL };
+
+	return &backend;
+}
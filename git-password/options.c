@@ -0,0 +1,251 @@
+//
+//  options.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "git_password.h"
+
+#define OPTIONS_PREFIX "git-password."
+#define OPTIONS_DEFAULT_CACHE_TTL 900
+#define OPTIONS_DEFAULT_NEGATIVE_TTL 60
+#define OPTIONS_DEFAULT_REFRESH_AHEAD 300
+
+enum
+{
+	OPTION_KEYCHAIN = 1 << 0,
+	OPTION_CACHE_TTL = 1 << 1,
+	OPTION_USE_HTTP_PATH = 1 << 2,
+	OPTION_INTERACTIVE = 1 << 3,
+	OPTION_TRACE = 1 << 4,
+	OPTION_NEGATIVE_TTL = 1 << 5,
+	OPTION_NEGATIVE_ON_DISK = 1 << 6,
+	OPTION_PROMPT_TIMEOUT = 1 << 7,
+	OPTION_REFRESH_COMMAND = 1 << 8,
+	OPTION_REFRESH_AHEAD = 1 << 9
+};
+
+// The values set under one [git-password] or [git-password "<url>"] section.
+struct OptionScope
+{
+	char * url;
+	size_t length;
+	unsigned set;
+	Options values;
+};
+typedef struct OptionScope OptionScope;
+
+static struct
+{
+	bool loaded;
+	Options defaults;
+	OptionScope * scopes;
+	size_t count;
+	size_t capacity;
+} options;
+
+static OptionScope * option_scope(const char * url, size_t length, FILE * terminal)
+{
+	OptionScope * scope;
+
+	for (size_t i = 0; i < options.count; i++)
+		if (options.scopes[i].length == length && strncmp(options.scopes[i].url, url, length) == 0)
+			return &options.scopes[i];
+
+	if (options.count == options.capacity)
+	{
+		options.capacity = options.capacity ? options.capacity * 2 : 4;
+		if ((options.scopes = realloc(options.scopes, options.capacity * sizeof(OptionScope))) == NULL)
+			fatal("unable to allocate memory", terminal);
+	}
+
+	scope = &options.scopes[options.count++];
+	memset(scope, 0, sizeof(OptionScope));
+	scope->length = length;
+	if ((scope->url = strndup(url, length)) == NULL)
+		fatal("unable to allocate memory", terminal);
+
+	return scope;
+}
+
+static int parse_seconds(const char * value, const char * name, long minimum, FILE * terminal)
+{
+	char * end, * message;
+	long seconds = strtol(value, &end, 10);
+
+	if (end == value || *end || seconds < minimum || seconds > INT32_MAX)
+	{
+		message = arena_printf(terminal, "git-password.%s must be a %s number of seconds", name, minimum > 0 ? "positive" : "non-negative");
+		fatal(message, terminal);
+	}
+
+	return (int)seconds;
+}
+
+static void visit_option(const char * key, const char * value, void * context)
+{
+	FILE * terminal = context;
+	const char * scoped, * name;
+	OptionScope * scope;
+
+	if (strncmp(key, OPTIONS_PREFIX, strlen(OPTIONS_PREFIX)) != 0)
+		return;
+
+	scoped = key + strlen(OPTIONS_PREFIX);
+	name = strrchr(scoped, '.');
+
+	scope = name ? option_scope(scoped, name - scoped, terminal) : option_scope("", 0, terminal);
+	name = name ? name + 1 : scoped;
+
+	if (strcmp(name, "keychain") == 0)
+	{
+		scope->values.keychain = value;
+		scope->set |= OPTION_KEYCHAIN;
+	}
+	else if (strcmp(name, "cachettl") == 0)
+	{
+		scope->values.cache_ttl = parse_seconds(value, "cacheTtl", 1, terminal);
+		scope->set |= OPTION_CACHE_TTL;
+	}
+	else if (strcmp(name, "negativettl") == 0)
+	{
+		scope->values.negative_ttl = parse_seconds(value, "negativeTtl", 0, terminal);
+		scope->set |= OPTION_NEGATIVE_TTL;
+	}
+	else if (strcmp(name, "negativeondisk") == 0)
+	{
+		scope->values.negative_on_disk = config_bool(value);
+		scope->set |= OPTION_NEGATIVE_ON_DISK;
+	}
+	else if (strcmp(name, "usehttppath") == 0)
+	{
+		scope->values.use_http_path = config_bool(value);
+		scope->set |= OPTION_USE_HTTP_PATH;
+	}
+	else if (strcmp(name, "interactive") == 0)
+	{
+		scope->values.interactive = config_bool(value);
+		scope->set |= OPTION_INTERACTIVE;
+	}
+	else if (strcmp(name, "prompttimeout") == 0)
+	{
+		scope->values.prompt_timeout = parse_seconds(value, "promptTimeout", 0, terminal);
+		scope->set |= OPTION_PROMPT_TIMEOUT;
+	}
+	else if (strcmp(name, "trace") == 0)
+	{
+		scope->values.trace = value;
+		scope->set |= OPTION_TRACE;
+	}
+	else if (strcmp(name, "refreshcommand") == 0)
+	{
+		scope->values.refresh_command = *value ? value : NULL;
+		scope->set |= OPTION_REFRESH_COMMAND;
+	}
+	else if (strcmp(name, "refreshahead") == 0)
+	{
+		scope->values.refresh_ahead = parse_seconds(value, "refreshAhead", 0, terminal);
+		scope->set |= OPTION_REFRESH_AHEAD;
+	}
+}
+
+// One pass over the config git would read collects every git-password.* key; the
+// strings stay owned by the config table for the life of the process.
+static void load_options(FILE * terminal)
+{
+	const char * value;
+
+	options.loaded = true;
+	options.defaults.keychain = NULL;
+	options.defaults.cache_ttl = OPTIONS_DEFAULT_CACHE_TTL;
+	options.defaults.negative_ttl = OPTIONS_DEFAULT_NEGATIVE_TTL;
+	options.defaults.negative_on_disk = false;
+	options.defaults.use_http_path = (value = config_get("credential.usehttppath", terminal)) && config_bool(value);
+	options.defaults.interactive = true;
+	options.defaults.prompt_timeout = 0;
+	options.defaults.trace = NULL;
+	options.defaults.refresh_command = NULL;
+	options.defaults.refresh_ahead = OPTIONS_DEFAULT_REFRESH_AHEAD;
+
+	config_each(visit_option, terminal, terminal);
+}
+
+static void apply_scope(Options * result, const OptionScope * scope)
+{
+	if (scope->set & OPTION_KEYCHAIN) result->keychain = scope->values.keychain;
+	if (scope->set & OPTION_CACHE_TTL) result->cache_ttl = scope->values.cache_ttl;
+	if (scope->set & OPTION_USE_HTTP_PATH) result->use_http_path = scope->values.use_http_path;
+	if (scope->set & OPTION_INTERACTIVE) result->interactive = scope->values.interactive;
+	if (scope->set & OPTION_TRACE) result->trace = scope->values.trace;
+	if (scope->set & OPTION_PROMPT_TIMEOUT) result->prompt_timeout = scope->values.prompt_timeout;
+	if (scope->set & OPTION_NEGATIVE_TTL) result->negative_ttl = scope->values.negative_ttl;
+	if (scope->set & OPTION_NEGATIVE_ON_DISK) result->negative_on_disk = scope->values.negative_on_disk;
+	if (scope->set & OPTION_REFRESH_COMMAND) result->refresh_command = scope->values.refresh_command;
+	if (scope->set & OPTION_REFRESH_AHEAD) result->refresh_ahead = scope->values.refresh_ahead;
+}
+
+static bool scope_matches(const OptionScope * scope, const char * url)
+{
+	if (!url || strncmp(url, scope->url, scope->length) != 0)
+		return false;
+
+	return url[scope->length] == 0 || url[scope->length] == '/' || scope->url[scope->length - 1] == '/';
+}
+
+// Effective options for a remote: [git-password] first, then every
+// [git-password "<url>"] whose url is a prefix of it, shortest to longest, so
+// the most specific section wins. A NULL url gives the unscoped values only.
+Options git_password_options(const char * url, FILE * terminal)
+{
+	Options result;
+	const char * keychain = getenv("GIT_PASSWORD_KEYCHAIN");
+	size_t applied = 0;
+
+	if (!options.loaded)
+		load_options(terminal);
+
+	result = options.defaults;
+	for (size_t i = 0; i < options.count; i++)
+		if (options.scopes[i].length == 0)
+			apply_scope(&result, &options.scopes[i]);
+
+	for (;;)
+	{
+		const OptionScope * next = NULL;
+
+		for (size_t i = 0; i < options.count; i++)
+			if (options.scopes[i].length > applied && scope_matches(&options.scopes[i], url) && (!next || options.scopes[i].length < next->length))
+				next = &options.scopes[i];
+		if (!next)
+			break;
+
+		apply_scope(&result, next);
+		applied = next->length;
+	}
+
+	if (keychain && *keychain)
+		result.keychain = keychain;
+
+	return result;
+}
@@ -0,0 +1,119 @@
+//
+//  refresh.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+extern char ** environ;
+
+// A credential is renewed once it is within refreshAhead seconds of expiring,
+// and only when git-password.refreshCommand says how.
+bool refresh_due(const char * repository, time_t expires)
+{
+	Options options;
+
+	if (!expires)
+		return false;
+	options = git_password_options(repository, stderr);
+
+	return options.refresh_command && expires - time(NULL) <= options.refresh_ahead;
+}
+
+// Runs the refresh command with the repository and the current username as its
+// arguments. It answers in the credential format, at least a password and
+// usually a new password_expiry_utc, which replaces the keychain item in
+// place. The renewed item is returned whether or not it could be stored.
+KeyChainItem * refresh_credentials(char * repository, const char * username, FILE * terminal)
+{
+	Options options = git_password_options(repository, terminal);
+	char * script = arena_printf(terminal, "%s \"$@\"", options.refresh_command);
+	char * arguments[] = { "/bin/sh", "-c", script, "git-password-refresh", repository, (char *)username, NULL };
+	posix_spawn_file_actions_t actions;
+	Credential credential;
+	KeyChainItem * result = NULL;
+	FILE * output;
+	double started;
+	pid_t child;
+	int pipes[2], exit_status, spawned;
+	OSStatus status;
+
+	if (!options.refresh_command || pipe(pipes) != 0)
+		return NULL;
+
+	started = trace_enter("refresh_credentials");
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_adddup2(&actions, pipes[1], STDOUT_FILENO);
+	posix_spawn_file_actions_addclose(&actions, pipes[0]);
+	posix_spawn_file_actions_addclose(&actions, pipes[1]);
+	spawned = posix_spawn(&child, arguments[0], &actions, NULL, arguments, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(pipes[1]);
+
+	if (spawned != 0 || (output = fdopen(pipes[0], "r")) == NULL)
+	{
+		close(pipes[0]);
+		if (spawned == 0)
+			waitpid(child, NULL, 0);
+		trace_leave("refresh_credentials", started);
+		fprintf(terminal, "warning: unable to run refresh command for %s\n", repository);
+		return NULL;
+	}
+
+	if (!read_credential(&credential, output))
+		memset(&credential, 0, sizeof(credential));
+	while (fgetc(output) != EOF)
+		;
+	fclose(output);
+	while (waitpid(child, &exit_status, 0) < 0 && errno == EINTR)
+		;
+
+	if (WIFEXITED(exit_status) && WEXITSTATUS(exit_status) == 0 && credential.password && *credential.password && (result = calloc(1, sizeof(KeyChainItem))) != NULL)
+	{
+		result->username = strdup(credential.username ? credential.username : username);
+		result->password = strdup(credential.password);
+		result->expires = credential_expiry(&credential);
+		if (!result->username || !result->password)
+		{
+			free_keychain_item(result);
+			result = NULL;
+		}
+		else if ((status = store_keychain_item(repository, result->username, result->password, result->expires)) != errSecSuccess)
+			fprintf(terminal, "warning: unable to store refreshed credentials for %s (%d)\n", repository, (int)status);
+	}
+	else
+		fprintf(terminal, "warning: refresh command failed for %s\n", repository);
+
+	free_credential(&credential);
+	trace_leave("refresh_credentials", started);
+
+	return result;
+}
@@ -0,0 +1,202 @@
+//
+//  resolve.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+#include <stdlib.h>
+#include <string.h>
+
+#include "git_password.h"
+
+// Results are kept per repository so that every url after the first one for a
+// repository is answered without going back to the keychain.
+struct ResolveEntry
+{
+	char * repository;
+	char * username;
+	OSStatus status;
+};
+typedef struct ResolveEntry ResolveEntry;
+
+struct ResolveTable
+{
+	ResolveEntry * entries;
+	size_t count;
+	size_t capacity;
+};
+typedef struct ResolveTable ResolveTable;
+
+static ResolveEntry * resolve_slot(ResolveEntry * entries, size_t capacity, const char * repository)
+{
+	size_t index = hash_string(repository) & (capacity - 1);
+
+	while (entries[index].repository && strcmp(entries[index].repository, repository) != 0)
+		index = (index + 1) & (capacity - 1);
+
+	return &entries[index];
+}
+
+static void resolve_grow(ResolveTable * table, FILE * terminal)
+{
+	size_t capacity = table->capacity ? table->capacity * 2 : 64;
+	ResolveEntry * entries = calloc(capacity, sizeof(ResolveEntry));
+
+	if (entries == NULL)
+		fatal("unable to allocate memory", terminal);
+	for (size_t i = 0; i < table->capacity; i++)
+		if (table->entries[i].repository)
+			*resolve_slot(entries, capacity, table->entries[i].repository) = table->entries[i];
+
+	free(table->entries);
+	table->entries = entries;
+	table->capacity = capacity;
+}
+
+// The password is never asked for, so nothing secret is read from the keychain
+// and no access prompt is raised for it. Keychain items are read directly rather
+// than through the keychain backend, whose lookup runs the refresh command; an
+// item that has expired is reported as missing, as git would see it.
+static OSStatus resolve_probe(Backend * source, char * repository, KeyChainItem ** item, FILE * terminal)
+{
+	OSStatus status;
+
+	if (injected_credentials(terminal))
+		return source->lookup(source, repository, false, item, terminal);
+
+	if ((status = copy_keychain_item(repository, false, item)) == errSecSuccess && (*item)->expires && (*item)->expires <= time(NULL))
+	{
+		free_keychain_item(*item);
+		*item = NULL;
+		status = errSecItemNotFound;
+	}
+
+	return status;
+}
+
+static ResolveEntry * resolve_repository(ResolveTable * table, Backend * source, char * repository, FILE * terminal)
+{
+	ResolveEntry * entry;
+	KeyChainItem * item = NULL;
+
+	if (table->count * 2 >= table->capacity)
+		resolve_grow(table, terminal);
+	entry = resolve_slot(table->entries, table->capacity, repository);
+	if (entry->repository)
+		return entry;
+
+	entry->status = resolve_probe(source, repository, &item, terminal);
+	if (entry->status == errSecSuccess && item->username && (entry->username = strdup(item->username)) == NULL)
+		fatal("unable to allocate memory", terminal);
+	if ((entry->repository = strdup(repository)) == NULL)
+		fatal("unable to allocate memory", terminal);
+	free_keychain_item(item);
+	table->count++;
+
+	return entry;
+}
+
+// Urls are separated by newlines or NULs, so both `git config --get-all` and
+// `find -print0` style producers can feed the batch directly.
+static char * resolve_read(FILE * input, char ** buffer, size_t * capacity, int * separator, FILE * terminal)
+{
+	size_t length = 0;
+	int c;
+
+	while ((c = getc(input)) != EOF && c != '\n' && c != '\0')
+	{
+		if (length + 1 >= *capacity)
+		{
+			*capacity = *capacity ? *capacity * 2 : 256;
+			if ((*buffer = realloc(*buffer, *capacity)) == NULL)
+				fatal("unable to allocate memory", terminal);
+		}
+		(*buffer)[length++] = c;
+	}
+	if (c == EOF && length == 0)
+		return NULL;
+
+	*separator = c == EOF ? '\n' : c;
+	if (*buffer == NULL && (*buffer = malloc(*capacity = 256)) == NULL)
+		fatal("unable to allocate memory", terminal);
+	(*buffer)[length] = '\0';
+
+	return *buffer;
+}
+
+// git-password resolve --batch: reads urls from stdin and writes one status line
+// per url, in input order and ended by the same separator as its url:
+//
+//     found<TAB><url><TAB><username>
+//     missing<TAB><url>
+//     declined<TAB><url>
+//     error<TAB><url><TAB><status>
+//
+// Each repository is looked up once however many urls map to it. Passwords are
+// never read, let alone printed.
+void run_resolve(int argc, const char * argv[], FILE * terminal)
+{
+	ResolveTable table = { NULL, 0, 0 };
+	char * buffer = NULL, * url;
+	size_t capacity = 0, urls = 0, found = 0;
+	int separator;
+	Backend * source;
+	double started;
+
+	if (argc != 1 || strcmp(argv[0], "--batch") != 0)
+		fatal("usage: git-password resolve --batch", terminal);
+
+	started = trace_enter("resolve");
+	source = source_backend(terminal);
+	while ((url = resolve_read(stdin, &buffer, &capacity, &separator, terminal)) != NULL)
+	{
+		ResolveEntry * entry;
+
+		for (; *url == ' ' || *url == '\t'; url++)
+			;
+		if (*url == '\0')
+			continue;
+
+		entry = resolve_repository(&table, source, canonical_repository(url, terminal), terminal);
+		if (entry->status == errSecSuccess)
+			printf("found\t%s\t%s%c", url, entry->username ? entry->username : "", separator);
+		else if (entry->status == errSecItemNotFound)
+			printf("missing\t%s%c", url, separator);
+		else if (entry->status == errSecUserCanceled)
+			printf("declined\t%s%c", url, separator);
+		else
+			printf("error\t%s\t%d%c", url, (int)entry->status, separator);
+		fflush(stdout);
+
+		found += entry->status == errSecSuccess;
+		urls++;
+		arena_reset();
+	}
+	trace_leave("resolve", started);
+
+	fprintf(terminal, "resolved %zu of %zu urls across %zu repositories\n", found, urls, table.count);
+	for (size_t i = 0; i < table.capacity; i++)
+	{
+		free(table.entries[i].repository);
+		free(table.entries[i].username);
+	}
+	free(table.entries);
+	free(buffer);
+}
@@ -0,0 +1,155 @@
+//
+//  secret.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "git_password.h"
+
+#define SECRET_CHUNK_SIZE (256 * 1024)
+#define SECRET_CLASS_COUNT (sizeof(secret_classes) / sizeof(*secret_classes))
+
+// Long-lived secrets live in a slab that is locked out of swap. Cells come in a
+// few sizes, each with its own free list; a freed cell is wiped and reused. The
+// slab grows by whole chunks, each locked before any cell is handed out of it,
+// so a secret can never land in pageable memory. The daemon's workers share it,
+// hence the lock. A secret too big for the largest cell gets a locked mapping of
+// its own instead.
+static const size_t secret_classes[] = { 64, 256, 1024, 4096 };
+
+struct SecretCell
+{
+	struct SecretCell * next;
+};
+typedef struct SecretCell SecretCell;
+
+static char * secret_chunk = NULL;
+static size_t secret_used = 0;
+static SecretCell * secret_free_lists[SECRET_CLASS_COUNT];
+static pthread_mutex_t secret_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void secret_push(size_t class, char * cell)
+{
+	((SecretCell *)cell)->next = secret_free_lists[class];
+	secret_free_lists[class] = (SecretCell *)cell;
+}
+
+// Called with secret_lock held once the current chunk cannot fit a cell. What
+// is left of it is cut into the largest cells that fit, so no locked memory
+// goes unused; chunks are never given back.
+static bool secret_grow(void)
+{
+	char * chunk;
+
+	if ((chunk = mmap(NULL, SECRET_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED)
+		return false;
+	if (mlock(chunk, SECRET_CHUNK_SIZE) != 0)
+	{
+		munmap(chunk, SECRET_CHUNK_SIZE);
+		return false;
+	}
+
+	for (size_t class = SECRET_CLASS_COUNT; secret_chunk && class-- > 0; )
+		for (; secret_used + secret_classes[class] <= SECRET_CHUNK_SIZE; secret_used += secret_classes[class])
+			secret_push(class, secret_chunk + secret_used);
+
+	secret_chunk = chunk;
+	secret_used = 0;
+
+	return true;
+}
+
+// A mapping starts with its length and then SECRET_CLASS_COUNT where a cell keeps
+// its class.
+static void * secret_map(size_t size)
+{
+	size_t length = size + 2 * sizeof(size_t), * mapping;
+
+	if ((mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED)
+		return NULL;
+	if (mlock(mapping, length) != 0)
+	{
+		munmap(mapping, length);
+		return NULL;
+	}
+
+	mapping[0] = length;
+	mapping[1] = SECRET_CLASS_COUNT;
+
+	return mapping + 2;
+}
+
+// Returns zeroed, locked memory for size bytes, or NULL when no more memory can
+// be locked; a size_t in front of each cell remembers its class.
+void * secret_alloc(size_t size)
+{
+	size_t class = 0, * cell = NULL;
+
+	while (class < SECRET_CLASS_COUNT && secret_classes[class] - sizeof(size_t) < size)
+		class++;
+	if (class == SECRET_CLASS_COUNT)
+		return size > SIZE_MAX - 2 * sizeof(size_t) ? NULL : secret_map(size);
+
+	pthread_mutex_lock(&secret_lock);
+	if (secret_free_lists[class])
+	{
+		cell = (size_t *)secret_free_lists[class];
+		secret_free_lists[class] = secret_free_lists[class]->next;
+		memset(cell, 0, sizeof(SecretCell));
+	}
+	else if ((secret_chunk && secret_used + secret_classes[class] <= SECRET_CHUNK_SIZE) || secret_grow())
+	{
+		cell = (size_t *)(secret_chunk + secret_used);
+		secret_used += secret_classes[class];
+	}
+	pthread_mutex_unlock(&secret_lock);
+
+	if (!cell)
+		return NULL;
+	*cell = class;
+
+	return cell + 1;
+}
+
+void secret_free(void * pointer)
+{
+	size_t * cell = (size_t *)pointer - 1, class;
+
+	if (!pointer)
+		return;
+
+	class = *cell;
+	if (class == SECRET_CLASS_COUNT)
+	{
+		memset(cell - 1, 0, cell[-1]);
+		munmap(cell - 1, cell[-1]);
+		return;
+	}
+	memset(cell, 0, secret_classes[class]);
+
+	pthread_mutex_lock(&secret_lock);
+	secret_push(class, (char *)cell);
+	pthread_mutex_unlock(&secret_lock);
+}
@@ -0,0 +1,162 @@
+//
+//  security.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <dlfcn.h>
+#include <stdlib.h>
+
+#include "git_password.h"
+
+#if GIT_PASSWORD_WITH_KEYCHAIN
+#ifndef CORE_FOUNDATION_PATH
+#define CORE_FOUNDATION_PATH "/System/Library/Frameworks/CoreFoundation.framework/CoreFoundation"
+#endif
+#ifndef SECURITY_PATH
+#define SECURITY_PATH "/System/Library/Frameworks/Security.framework/Security"
+#endif
+
+#define LOAD_FUNCTION(handle, symbol) \
+	if ((api.symbol = dlsym(handle, #symbol)) == NULL) return NULL
+#define LOAD_CONSTANT(handle, symbol) \
+	if ((constant = dlsym(handle, #symbol)) == NULL) return NULL; \
+	api.symbol = *(__typeof__(api.symbol) *)constant
+
+static SecurityApi api;
+
+static const SecurityApi * load_security_api(void)
+{
+	void * core_foundation = dlopen(CORE_FOUNDATION_PATH, RTLD_LAZY | RTLD_LOCAL);
+	void * security = dlopen(SECURITY_PATH, RTLD_LAZY | RTLD_LOCAL);
+	void * constant;
+
+	if (!core_foundation || !security)
+		return NULL;
+
+	LOAD_FUNCTION(core_foundation, CFArrayCreate);
+	LOAD_FUNCTION(core_foundation, CFArrayGetCount);
+	LOAD_FUNCTION(core_foundation, CFArrayGetValueAtIndex);
+	LOAD_FUNCTION(core_foundation, CFDataGetBytePtr);
+	LOAD_FUNCTION(core_foundation, CFDataGetLength);
+	LOAD_FUNCTION(core_foundation, CFDictionaryCreateMutable);
+	LOAD_FUNCTION(core_foundation, CFDictionaryGetValue);
+	LOAD_FUNCTION(core_foundation, CFDictionarySetValue);
+	LOAD_FUNCTION(core_foundation, CFRelease);
+	LOAD_FUNCTION(core_foundation, CFRunLoopRun);
+	LOAD_FUNCTION(core_foundation, CFStringCreateWithCString);
+	LOAD_FUNCTION(core_foundation, CFStringGetCString);
+	LOAD_FUNCTION(core_foundation, CFStringGetLength);
+	LOAD_FUNCTION(core_foundation, CFStringGetMaximumSizeForEncoding);
+	api.kCFTypeArrayCallBacks = dlsym(core_foundation, "kCFTypeArrayCallBacks");
+	api.kCFTypeDictionaryKeyCallBacks = dlsym(core_foundation, "kCFTypeDictionaryKeyCallBacks");
+	api.kCFTypeDictionaryValueCallBacks = dlsym(core_foundation, "kCFTypeDictionaryValueCallBacks");
+	if (!api.kCFTypeArrayCallBacks || !api.kCFTypeDictionaryKeyCallBacks || !api.kCFTypeDictionaryValueCallBacks)
+		return NULL;
+	LOAD_CONSTANT(core_foundation, kCFBooleanTrue);
+
+	LOAD_FUNCTION(security, SecCopyErrorMessageString);
+	LOAD_FUNCTION(security, SecItemCopyMatching);
+	LOAD_FUNCTION(security, SecKeychainAddCallback);
+	LOAD_FUNCTION(security, SecKeychainAttributeInfoForItemID);
+	LOAD_FUNCTION(security, SecKeychainCreate);
+	LOAD_FUNCTION(security, SecKeychainDelete);
+	LOAD_FUNCTION(security, SecKeychainFindGenericPassword);
+	LOAD_FUNCTION(security, SecKeychainFreeAttributeInfo);
+	LOAD_FUNCTION(security, SecKeychainItemCopyAttributesAndData);
+	LOAD_FUNCTION(security, SecKeychainItemCopyContent);
+	LOAD_FUNCTION(security, SecKeychainItemCreateFromContent);
+	LOAD_FUNCTION(security, SecKeychainItemDelete);
+	LOAD_FUNCTION(security, SecKeychainItemFreeAttributesAndData);
+	LOAD_FUNCTION(security, SecKeychainItemFreeContent);
+	LOAD_FUNCTION(security, SecKeychainItemModifyAttributesAndData);
+	LOAD_FUNCTION(security, SecKeychainOpen);
+	LOAD_CONSTANT(security, kSecAttrAccount);
+	LOAD_CONSTANT(security, kSecAttrComment);
+	LOAD_CONSTANT(security, kSecAttrDescription);
+	LOAD_CONSTANT(security, kSecAttrService);
+	LOAD_CONSTANT(security, kSecClass);
+	LOAD_CONSTANT(security, kSecClassGenericPassword);
+	LOAD_CONSTANT(security, kSecMatchLimit);
+	LOAD_CONSTANT(security, kSecMatchLimitAll);
+	LOAD_CONSTANT(security, kSecMatchLimitOne);
+	LOAD_CONSTANT(security, kSecMatchSearchList);
+	LOAD_CONSTANT(security, kSecReturnAttributes);
+	LOAD_CONSTANT(security, kSecReturnData);
+	LOAD_CONSTANT(security, kSecReturnRef);
+	LOAD_CONSTANT(security, kSecValueData);
+	LOAD_CONSTANT(security, kSecValueRef);
+
+	return &api;
+}
+
+// The frameworks are not linked; they are opened the first time a keychain is
+// touched, so runs answered by the daemon or rejected early never bind them.
+const SecurityApi * security_api(void)
+{
+	static bool loaded = false;
+	static const SecurityApi * result = NULL;
+
+	if (!loaded)
+	{
+		double started = trace_enter("load_frameworks");
+
+		result = load_security_api();
+		loaded = true;
+		trace_leave("load_frameworks", started);
+	}
+
+	return result;
+}
+
+static void security_fatal(OSStatus status, FILE * terminal)
+{
+	const SecurityApi * api = security_api();
+	char buffer[256] = "";
+	CFStringRef message = api ? api->SecCopyErrorMessageString(status, NULL) : NULL;
+
+	if (!message || !api->CFStringGetCString(message, buffer, sizeof(buffer), kCFStringEncodingUTF8))
+		snprintf(buffer, sizeof(buffer), status == errSecNotAvailable ? "Security.framework is not available" : "security error %d", (int)status);
+	if (message)
+		api->CFRelease(message);
+
+	fatal(buffer, terminal);
+}
+#else
+const SecurityApi * security_api(void)
+{
+	return NULL;
+}
+
+static void security_fatal(OSStatus status, FILE * terminal)
+{
+	char buffer[64];
+
+	snprintf(buffer, sizeof(buffer), status == errSecNotAvailable ? "built without the keychain" : "security error %d", (int)status);
+	fatal(buffer, terminal);
+}
+#endif
+
+void security(OSStatus status, FILE * terminal)
+{
+	if (status != 0)
+		security_fatal(status, terminal);
+}
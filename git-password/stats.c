@@ -0,0 +1,282 @@
+//
+//  stats.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+#define STATS_BUCKETS 28
+#define STATS_FAILURE_SLOTS 32
+#define STATS_PENDING_LIMIT (64 * 1024)
+
+// Counters are only ever added to, from the event loop and every worker at
+// once, with relaxed atomics; a snapshot may be a few events apart across
+// fields, which is fine for monitoring. Latencies go into power-of-two buckets
+// of microseconds, bucket i holding those below 2^i and the last one the rest.
+struct StatCounter
+{
+	uint64_t count;
+	uint64_t timed;
+	uint64_t total_us;
+	uint64_t buckets[STATS_BUCKETS];
+};
+typedef struct StatCounter StatCounter;
+
+// Failures are kept per OSStatus in a small open-addressed table; a slot is
+// claimed once by compare-and-swap and never given back.
+struct StatFailure
+{
+	int32_t status;
+	uint64_t count;
+};
+typedef struct StatFailure StatFailure;
+
+static const char * stat_names[STAT_EVENTS] = { "hits", "misses", "negative_hits", "keychain_lookups", "prompts", "keychain_stores", "invalidations" };
+
+static bool stats_serving = false;
+static time_t stats_started;
+static StatCounter stats_counters[STAT_EVENTS];
+static StatFailure stats_failures[STATS_FAILURE_SLOTS];
+static uint64_t stats_failures_dropped;
+
+static char * stats_pending = NULL;
+static size_t stats_pending_length = 0, stats_pending_capacity = 0;
+
+#define STAT_ADD(field, value) __atomic_fetch_add(&(field), (value), __ATOMIC_RELAXED)
+#define STAT_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+// The daemon keeps the numbers; run_daemon calls this before serving.
+void stats_serve(void)
+{
+	stats_serving = true;
+	stats_started = time(NULL);
+}
+
+static void stats_failure(OSStatus status)
+{
+	size_t slot = (uint32_t)status % STATS_FAILURE_SLOTS;
+
+	for (size_t probe = 0; probe < STATS_FAILURE_SLOTS; probe++, slot = (slot + 1) % STATS_FAILURE_SLOTS)
+	{
+		int32_t expected = 0, current = __atomic_load_n(&stats_failures[slot].status, __ATOMIC_ACQUIRE);
+
+		if (current == 0 && !__atomic_compare_exchange_n(&stats_failures[slot].status, &expected, (int32_t)status, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			current = expected;
+		if (current == 0 || current == status)
+		{
+			STAT_ADD(stats_failures[slot].count, 1);
+			return;
+		}
+	}
+
+	STAT_ADD(stats_failures_dropped, 1);
+}
+
+static void stats_flush(void)
+{
+	if (stats_pending_length == 0)
+		return;
+
+	daemon_report(stats_pending);
+	stats_pending_length = 0;
+	stats_pending[0] = '\0';
+}
+
+// Outside the daemon events are kept until the process exits and then sent in
+// one request, so a bulk command does not connect once per item.
+static void stats_defer(enum StatEvent event, double seconds, OSStatus status)
+{
+	char line[64];
+	int length = snprintf(line, sizeof(line), "%s %.6f %d\n", stat_names[event], seconds, (int)status);
+	char * pending;
+
+	if (length <= 0 || (size_t)length >= sizeof(line))
+		return;
+	if (stats_pending_length + length + 1 > stats_pending_capacity)
+	{
+		if ((pending = realloc(stats_pending, stats_pending_capacity + sizeof(line) * 32)) == NULL)
+			return;
+		if (!stats_pending)
+			atexit(stats_flush);
+		stats_pending = pending;
+		stats_pending_capacity += sizeof(line) * 32;
+	}
+
+	memcpy(stats_pending + stats_pending_length, line, length + 1);
+	if ((stats_pending_length += length) >= STATS_PENDING_LIMIT)
+		stats_flush();
+}
+
+// seconds is negative for an event without a latency. Outside the daemon the
+// event is sent to it instead, where one is running.
+void stats_record(enum StatEvent event, double seconds, OSStatus status)
+{
+	StatCounter * counter = &stats_counters[event];
+	uint64_t microseconds;
+	size_t bucket = 0;
+
+	if (!stats_serving)
+	{
+		stats_defer(event, seconds, status);
+		return;
+	}
+
+	STAT_ADD(counter->count, 1);
+	if (status != errSecSuccess && status != errSecItemNotFound && status != errSecUserCanceled)
+		stats_failure(status);
+	if (seconds < 0)
+		return;
+
+	microseconds = (uint64_t)(seconds * 1e6);
+	while (bucket < STATS_BUCKETS - 1 && microseconds >= (1ull << bucket))
+		bucket++;
+	STAT_ADD(counter->timed, 1);
+	STAT_ADD(counter->total_us, microseconds);
+	STAT_ADD(counter->buckets[bucket], 1);
+}
+
+// One "<event> <seconds> <status>" line of a front end's report.
+void stats_report(const char * report)
+{
+	char name[32];
+	double seconds;
+	int status;
+
+	if (sscanf(report, "%31s %lf %d", name, &seconds, &status) != 3)
+		return;
+
+	for (int event = 0; event < STAT_EVENTS; event++)
+		if (strcmp(name, stat_names[event]) == 0)
+			stats_record(event, seconds, status);
+}
+
+// Upper bound in microseconds of the bucket holding the given fraction of the
+// timed events, or 0 when there are none.
+static uint64_t stats_percentile(const uint64_t * buckets, uint64_t timed, double fraction)
+{
+	uint64_t seen = 0, wanted = (uint64_t)(timed * fraction + 0.999999);
+
+	if (!timed)
+		return 0;
+	for (size_t i = 0; i < STATS_BUCKETS - 1; i++)
+		if ((seen += buckets[i]) >= wanted)
+			return 1ull << i;
+
+	return 1ull << (STATS_BUCKETS - 1);
+}
+
+// One "name value" line per figure, or a single JSON object.
+void stats_write(int fd, bool json)
+{
+	uint64_t counts[STAT_EVENTS], buckets[STATS_BUCKETS], timed, total;
+	uint64_t hits, lookups;
+	const char * separator = "";
+
+	for (int event = 0; event < STAT_EVENTS; event++)
+		counts[event] = STAT_LOAD(stats_counters[event].count);
+	hits = counts[STAT_HIT] + counts[STAT_NEGATIVE_HIT];
+	lookups = hits + counts[STAT_MISS];
+
+	if (json)
+	{
+		dprintf(fd, "{\"uptime_seconds\":%lld,\"counters\":{", (long long)(time(NULL) - stats_started));
+		for (int event = 0; event < STAT_EVENTS; event++)
+			dprintf(fd, "%s\"%s\":%llu", event ? "," : "", stat_names[event], (unsigned long long)counts[event]);
+		dprintf(fd, "},\"hit_rate\":%.4f,\"bucket_bounds_us\":[", lookups ? (double)hits / lookups : 0.0);
+		for (size_t i = 0; i < STATS_BUCKETS - 1; i++)
+			dprintf(fd, "%s%llu", i ? "," : "", 1ull << i);
+		dprintf(fd, "],\"latency_us\":{");
+	}
+	else
+	{
+		dprintf(fd, "uptime_seconds %lld\n", (long long)(time(NULL) - stats_started));
+		for (int event = 0; event < STAT_EVENTS; event++)
+			dprintf(fd, "%s %llu\n", stat_names[event], (unsigned long long)counts[event]);
+		dprintf(fd, "hit_rate %.4f\n", lookups ? (double)hits / lookups : 0.0);
+	}
+
+	for (int event = 0; event < STAT_EVENTS; event++)
+	{
+		if ((timed = STAT_LOAD(stats_counters[event].timed)) == 0)
+			continue;
+		total = STAT_LOAD(stats_counters[event].total_us);
+		for (size_t i = 0; i < STATS_BUCKETS; i++)
+			buckets[i] = STAT_LOAD(stats_counters[event].buckets[i]);
+
+		if (json)
+		{
+			dprintf(fd, "%s\"%s\":{\"count\":%llu,\"sum\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"buckets\":[", separator, stat_names[event], (unsigned long long)timed, (unsigned long long)total,
+				(unsigned long long)stats_percentile(buckets, timed, 0.5), (unsigned long long)stats_percentile(buckets, timed, 0.9), (unsigned long long)stats_percentile(buckets, timed, 0.99));
+			for (size_t i = 0; i < STATS_BUCKETS; i++)
+				dprintf(fd, "%s%llu", i ? "," : "", (unsigned long long)buckets[i]);
+			dprintf(fd, "]}");
+			separator = ",";
+		}
+		else
+			dprintf(fd, "latency %s count=%llu mean_us=%llu p50_us<=%llu p90_us<=%llu p99_us<=%llu\n", stat_names[event], (unsigned long long)timed, (unsigned long long)(total / timed),
+				(unsigned long long)stats_percentile(buckets, timed, 0.5), (unsigned long long)stats_percentile(buckets, timed, 0.9), (unsigned long long)stats_percentile(buckets, timed, 0.99));
+	}
+
+	if (json)
+		dprintf(fd, "},\"failures\":{");
+	separator = "";
+	for (size_t slot = 0; slot < STATS_FAILURE_SLOTS; slot++)
+	{
+		int32_t status = __atomic_load_n(&stats_failures[slot].status, __ATOMIC_ACQUIRE);
+
+		if (!status)
+			continue;
+		if (json)
+			dprintf(fd, "%s\"%d\":%llu", separator, (int)status, (unsigned long long)STAT_LOAD(stats_failures[slot].count));
+		else
+			dprintf(fd, "failure %d %llu\n", (int)status, (unsigned long long)STAT_LOAD(stats_failures[slot].count));
+		separator = ",";
+	}
+	if (json)
+		dprintf(fd, "},\"failures_dropped\":%llu}\n", (unsigned long long)STAT_LOAD(stats_failures_dropped));
+	else if (STAT_LOAD(stats_failures_dropped))
+		dprintf(fd, "failures_dropped %llu\n", (unsigned long long)STAT_LOAD(stats_failures_dropped));
+}
+
+// git-password stats [--json]: what the running daemon has counted since it
+// started.
+void run_stats(int argc, const char * argv[], FILE * terminal)
+{
+	bool json = false;
+
+	for (int i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--json") == 0)
+			json = true;
+		else
+			fatal("usage: git-password stats [--json]", terminal);
+	}
+
+	if (!daemon_stats(STDOUT_FILENO, json, terminal))
+		fatal("daemon is not running", terminal);
+}
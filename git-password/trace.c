@@ -0,0 +1,124 @@
+//
+//  trace.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+// GIT_TRACE2_EVENT, or git-password.trace when that is unset, is "1"/"true" for
+// stderr, a file descriptor from 2 to 9, an absolute file path, or a directory in
+// which a file named after the sid is made.
+static int trace_fd = -1;
+static pthread_once_t trace_opened = PTHREAD_ONCE_INIT;
+
+// Regions nest per thread; the daemon traces from its workers as well, and each
+// thread it starts names itself the way git does, "th01:worker" and so on.
+static _Thread_local int trace_nesting = 0;
+static _Thread_local char trace_thread_name[32] = "main";
+static int trace_threads = 0;
+
+static char trace_sid[256];
+
+static void trace_open(void)
+{
+	const char * target = getenv("GIT_TRACE2_EVENT"), * parent = getenv("GIT_TRACE2_PARENT_SID");
+	char hostname[256] = "", path[PATH_MAX], stamp[32];
+	struct timeval now;
+	struct stat info;
+
+	if (!target)
+		target = git_password_options(NULL, stderr).trace;
+	if (!target || !*target || strcmp(target, "0") == 0 || strcasecmp(target, "false") == 0)
+		return;
+
+	gettimeofday(&now, NULL);
+	strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%S", gmtime(&now.tv_sec));
+	gethostname(hostname, sizeof(hostname));
+	snprintf(trace_sid, sizeof(trace_sid), "%s%s%s.%06dZ-H%08x-P%08x", parent ? parent : "", parent ? "/" : "", stamp, (int)now.tv_usec, (unsigned)hash_string(hostname), (unsigned)getpid());
+	setenv("GIT_TRACE2_PARENT_SID", trace_sid, 1);
+
+	if (strcmp(target, "1") == 0 || strcasecmp(target, "true") == 0)
+		trace_fd = 2;
+	else if (target[0] >= '2' && target[0] <= '9' && target[1] == 0)
+		trace_fd = target[0] - '0';
+	else if (target[0] == '/' && stat(target, &info) == 0 && S_ISDIR(info.st_mode))
+	{
+		snprintf(path, sizeof(path), "%s/%s", target, strrchr(trace_sid, '/') ? strrchr(trace_sid, '/') + 1 : trace_sid);
+		trace_fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	}
+	else if (target[0] == '/')
+		trace_fd = open(target, O_WRONLY | O_APPEND | O_CREAT, 0666);
+}
+
+static void trace_event(const char * event, const char * label, double elapsed)
+{
+	char line[1024], stamp[32], relative[48] = "";
+	struct timeval now;
+	int length;
+
+	gettimeofday(&now, NULL);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", gmtime(&now.tv_sec));
+	if (elapsed >= 0)
+		snprintf(relative, sizeof(relative), ",\"t_rel\":%.6f", elapsed);
+
+	length = snprintf(line, sizeof(line), "{\"event\":\"%s\",\"sid\":\"%s\",\"thread\":\"%s\",\"time\":\"%s.%06dZ\",\"nesting\":%d,\"category\":\"git-password\",\"label\":\"%s\"%s}\n",
+		event, trace_sid, trace_thread_name, stamp, (int)now.tv_usec, trace_nesting, label, relative);
+	if (length > 0 && length < sizeof(line))
+		write(trace_fd, line, length);
+}
+
+void trace_thread(const char * name)
+{
+	snprintf(trace_thread_name, sizeof(trace_thread_name), "th%02d:%s", __atomic_add_fetch(&trace_threads, 1, __ATOMIC_RELAXED), name);
+}
+
+double trace_enter(const char * label)
+{
+	pthread_once(&trace_opened, trace_open);
+	if (trace_fd < 0)
+		return 0;
+
+	trace_nesting++;
+	trace_event("region_enter", label, -1);
+
+	return now_seconds();
+}
+
+void trace_leave(const char * label, double started)
+{
+	if (trace_fd < 0)
+		return;
+
+	trace_event("region_leave", label, now_seconds() - started);
+	trace_nesting--;
+}
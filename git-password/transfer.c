@@ -0,0 +1,115 @@
+//
+//  transfer.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+static FILE * transfer_stream(int argc, const char * argv[], bool output, FILE * terminal)
+{
+	FILE * stream;
+	int fd;
+
+	if (argc > 1)
+		fatal(output ? "usage: git-password export [<file>]" : "usage: git-password import [<file>]", terminal);
+	if (argc == 0 || strcmp(argv[0], "-") == 0)
+		return output ? stdout : stdin;
+
+	// The mode given to open only applies to a new file, so one that already
+	// exists is made private before it is emptied and written.
+	if (output && (fd = open(argv[0], O_WRONLY | O_CREAT, 0600)) >= 0 && (fchmod(fd, 0600) != 0 || ftruncate(fd, 0) != 0))
+		fatal("unable to make the credential file private", terminal);
+	if (!output)
+		fd = open(argv[0], O_RDONLY);
+	if (fd < 0 || (stream = fdopen(fd, output ? "w" : "r")) == NULL)
+		fatal("unable to open credential file", terminal);
+
+	return stream;
+}
+
+// git-password import [<file>]: url=/username=/password= blocks, as in the
+// credential protocol, are stored into the keychain. Items that already exist
+// are updated in place, so an import can simply be run again.
+void run_import(int argc, const char * argv[], FILE * terminal)
+{
+	FILE * input = transfer_stream(argc, argv, false, terminal);
+	double started = trace_enter("import");
+	Credential credential;
+	char * url, * repository;
+	unsigned imported = 0;
+
+	while (!feof(input))
+	{
+		if (!read_credential(&credential, input))
+			fatal("malformed credential attribute", terminal);
+		if ((url = credential_url(&credential, terminal)) == NULL)
+		{
+			if (credential.username || credential.password)
+				fatal("credential without a url", terminal);
+			free_credential(&credential);
+			continue;
+		}
+		if (!credential.username || !credential.password)
+			fatal(arena_printf(terminal, "credential for %s needs both a username and a password", url), terminal);
+
+		repository = canonical_repository(url, terminal);
+		security(store_keychain_item(repository, credential.username, credential.password, credential_expiry(&credential)), terminal);
+		imported++;
+
+		free_credential(&credential);
+		arena_reset();
+	}
+
+	if (input != stdin)
+		fclose(input);
+	trace_leave("import", started);
+	fprintf(terminal, "imported %u credentials\n", imported);
+}
+
+static void export_item(const char * repository, KeyChainItem * item, void * context)
+{
+	fprintf(context, "url=%s\nusername=%s\npassword=%s\n", repository, item->username, item->password);
+	if (item->expires)
+		fprintf(context, "password_expiry_utc=%lld\n", (long long)item->expires);
+	fputc('\n', context);
+}
+
+// git-password export [<file>]: every item git-password stored, in the format
+// import reads. A file is left readable by its owner only, even one that was
+// already there.
+void run_export(int argc, const char * argv[], FILE * terminal)
+{
+	FILE * output = transfer_stream(argc, argv, true, terminal);
+	double started = trace_enter("export");
+
+	security(each_keychain_item(export_item, output), terminal);
+
+	if (fflush(output) != 0 || (output != stdout && fclose(output) != 0))
+		fatal("unable to write credential file", terminal);
+	trace_leave("export", started);
+}
@@ -0,0 +1,282 @@
+//
+//  url.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "git_password.h"
+
+static char * copy_lowercase(const char * start, size_t length, FILE * terminal)
+{
+	char * result = malloc(length + 1);
+
+	if (!result)
+		fatal("unable to allocate memory", terminal);
+
+	for (size_t i = 0; i < length; i++)
+		result[i] = tolower((unsigned char)start[i]);
+	result[length] = 0;
+
+	return result;
+}
+
+static int default_port(const char * scheme)
+{
+	if (strcmp(scheme, "https") == 0)
+		return 443;
+	if (strcmp(scheme, "http") == 0)
+		return 80;
+	if (strcmp(scheme, "ssh") == 0 || strcmp(scheme, "git+ssh") == 0 || strcmp(scheme, "ssh+git") == 0)
+		return 22;
+	if (strcmp(scheme, "git") == 0)
+		return 9418;
+
+	return 0;
+}
+
+// Accepts scheme://[user@]host[:port][/path] and scp-style [user@]host:path.
+// Local paths and anything else that names no host are rejected.
+bool parse_remote_url(const char * url, RemoteUrl * result, FILE * terminal)
+{
+	const char * separator = strstr(url, "://"), * authority, * path, * host, * port = NULL, * end;
+	size_t length;
+
+	memset(result, 0, sizeof(*result));
+
+	if (separator)
+	{
+		result->scheme = copy_lowercase(url, separator - url, terminal);
+		authority = separator + 3;
+		path = authority + strcspn(authority, "/?#");
+	}
+	else
+	{
+		const char * colon = strchr(url, ':'), * slash = strchr(url, '/');
+
+		if (!colon || colon == url || (slash && slash < colon))
+			return false;
+
+		result->scheme = copy_lowercase("ssh", 3, terminal);
+		authority = url;
+		path = colon;
+	}
+
+	for (host = path; host > authority && host[-1] != '@'; host--);
+
+	if (*host == '[')
+	{
+		if ((end = memchr(host, ']', path - host)) == NULL)
+		{
+			free_remote_url(result);
+			return false;
+		}
+		end++;
+		if (end < path && *end == ':')
+			port = end + 1;
+	}
+	else
+	{
+		end = separator ? memchr(host, ':', path - host) : path;
+		if (!end)
+			end = path;
+		else if (end < path)
+			port = end + 1;
+	}
+
+	if (end == host)
+	{
+		free_remote_url(result);
+		return false;
+	}
+
+	result->host = copy_lowercase(host, end - host, terminal);
+	if (port && port < path)
+		result->port = atoi(port);
+	if (result->port == default_port(result->scheme))
+		result->port = 0;
+
+	path += strspn(path, separator ? "/" : ":/");
+	length = strcspn(path, "?#");
+	while (length && path[length - 1] == '/')
+		length--;
+	if (length >= 4 && strncasecmp(path + length - 4, ".git", 4) == 0)
+		length -= 4;
+	if ((result->path = malloc(length + 1)) == NULL)
+		fatal("unable to allocate memory", terminal);
+	memcpy(result->path, path, length);
+	result->path[length] = 0;
+
+	return true;
+}
+
+void free_remote_url(RemoteUrl * url)
+{
+	free(url->scheme);
+	free(url->host);
+	free(url->path);
+	memset(url, 0, sizeof(*url));
+}
+
+// url.<base>.insteadOf rules live in a byte trie keyed on the alias, so the
+// longest matching alias is found in one walk over the url however many rules
+// the config has. When two rules share an alias the first one defined wins.
+// url.<base>.pushInsteadOf rules get a trie of their own.
+struct RewriteNode
+{
+	char byte;
+	const char * base;
+	struct RewriteNode * child;
+	struct RewriteNode * sibling;
+};
+typedef struct RewriteNode RewriteNode;
+
+static RewriteNode rewrites, push_rewrites;
+static bool rewrites_loaded = false;
+
+static RewriteNode * rewrite_child(RewriteNode * node, char byte, FILE * terminal)
+{
+	RewriteNode * child;
+
+	for (child = node->child; child; child = child->sibling)
+		if (child->byte == byte)
+			return child;
+
+	if ((child = calloc(1, sizeof(RewriteNode))) == NULL)
+		fatal("unable to allocate memory", terminal);
+	child->byte = byte;
+	child->sibling = node->child;
+	node->child = child;
+
+	return child;
+}
+
+static bool rewrite_key(const char * key, const char * suffix)
+{
+	size_t length = strlen(key);
+
+	return strncmp(key, "url.", 4) == 0 && length > 4 + strlen(suffix) && strcmp(key + length - strlen(suffix), suffix) == 0;
+}
+
+static void visit_rewrite(const char * key, const char * value, void * context)
+{
+	bool push = rewrite_key(key, ".pushinsteadof");
+	const char * suffix = push ? ".pushinsteadof" : ".insteadof";
+	size_t length = strlen(key);
+	RewriteNode * node = push ? &push_rewrites : &rewrites;
+	char * base;
+
+	if (!rewrite_key(key, suffix) || !*value)
+		return;
+
+	for (const char * alias = value; *alias; alias++)
+		node = rewrite_child(node, *alias, context);
+	if (node->base)
+		return;
+
+	if ((base = strndup(key + 4, length - 4 - strlen(suffix))) == NULL)
+		fatal("unable to allocate memory", context);
+	node->base = base;
+}
+
+static const RewriteNode * rewrite_match(const RewriteNode * node, const char * url, size_t * matched)
+{
+	const RewriteNode * longest = NULL;
+
+	*matched = 0;
+	for (size_t i = 0; url[i] && (node = node->child); i++)
+	{
+		while (node && node->byte != url[i])
+			node = node->sibling;
+		if (!node)
+			break;
+		if (node->base)
+		{
+			longest = node;
+			*matched = i + 1;
+		}
+	}
+
+	return longest;
+}
+
+static void load_rewrites(FILE * terminal)
+{
+	if (!rewrites_loaded)
+	{
+		config_each(visit_rewrite, terminal, terminal);
+		rewrites_loaded = true;
+	}
+}
+
+// The url git would actually fetch from once url.<base>.insteadOf is applied.
+// Only raw config values need this; git rewrites the urls it hands us itself.
+char * rewrite_url(const char * url, FILE * terminal)
+{
+	const RewriteNode * longest;
+	size_t matched;
+
+	load_rewrites(terminal);
+	longest = rewrite_match(&rewrites, url, &matched);
+
+	return arena_printf(terminal, "%s%s", longest ? longest->base : "", url + matched);
+}
+
+// The url git pushes to for a remote.<name>.url: a pushInsteadOf rule wins over
+// insteadOf, as in git. A remote.<name>.pushurl only ever takes insteadOf.
+char * rewrite_push_url(const char * url, FILE * terminal)
+{
+	const RewriteNode * longest;
+	size_t matched;
+
+	load_rewrites(terminal);
+	if ((longest = rewrite_match(&push_rewrites, url, &matched)) == NULL)
+		return rewrite_url(url, terminal);
+
+	return arena_printf(terminal, "%s%s", longest->base, url + matched);
+}
+
+// The keychain service for a remote: scheme://host[:port]/ with the
+// userinfo, default port and case differences removed, optionally followed by
+// the repository path when git-password.useHttpPath (or credential.useHttpPath)
+// is set for it. Unparseable URLs are used verbatim.
+char * canonical_repository(const char * url, FILE * terminal)
+{
+	RemoteUrl parsed;
+	char * result, port[16] = "";
+
+	if (!parse_remote_url(url, &parsed, terminal))
+		return arena_copy(url, strlen(url), terminal);
+
+	if (parsed.port)
+		snprintf(port, sizeof(port), ":%d", parsed.port);
+	result = arena_printf(terminal, "%s://%s%s/%s", parsed.scheme, parsed.host, port, parsed.path);
+	if (!git_password_options(result, terminal).use_http_path)
+		result[strlen(parsed.scheme) + 3 + strlen(parsed.host) + strlen(port) + 1] = 0;
+
+	free_remote_url(&parsed);
+
+	return result;
+}
@@ -0,0 +1,181 @@
+//
+//  util.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "git_password.h"
+
+void fatal(const char * message, FILE * terminal)
+{
+	fprintf(terminal, "fatal: %s\n", message);
+	exit(-1);
+}
+
+UInt32 len(const char * string)
+{
+	return (UInt32)strlen(string);
+}
+
+char * trim_trailing_whitespace(char * string)
+{	
+	size_t length = strlen(string);
+
+	if (length > 0 && string[length - 1] == '\n')
+		string[length - 1] = 0;
+
+	return string;
+}
+
+uint64_t hash_string(const char * string)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (*string)
+		hash = (hash ^ (unsigned char)*string++) * 0x100000001b3ULL;
+
+	return hash;
+}
+
+double now_seconds(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return now.tv_sec + now.tv_usec / 1e6;
+}
+
+// Per-user scratch space shared by every invocation; confstr() gives the same
+// answer to launchd jobs and shells, where TMPDIR may differ.
+// NULL, with *problem saying why, when the directory cannot be made or is not
+// private to the user.
+const char * find_runtime_directory(const char ** problem)
+{
+	static char * directory = NULL;
+	char base[PATH_MAX], * path;
+	struct stat info;
+
+	if (directory)
+		return directory;
+
+	if (confstr(_CS_DARWIN_USER_TEMP_DIR, base, sizeof(base)) == 0)
+		strlcpy(base, getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", sizeof(base));
+	if (asprintf(&path, "%s/git-password-%d", base, (int)getuid()) < 0)
+	{
+		*problem = "unable to allocate memory";
+		return NULL;
+	}
+
+	if (mkdir(path, 0700) != 0 && errno != EEXIST)
+		*problem = "unable to create runtime directory";
+	else if (lstat(path, &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != getuid() || (info.st_mode & 077))
+		*problem = "runtime directory is not private";
+	else
+		return directory = path;
+
+	free(path);
+
+	return NULL;
+}
+
+const char * runtime_directory(FILE * terminal)
+{
+	const char * problem, * directory = find_runtime_directory(&problem);
+
+	if (!directory)
+		fatal(problem, terminal);
+
+	return directory;
+}
+
+char * copy_bytes(const void * data, UInt32 length)
+{
+	char * result = malloc(length + 1);
+
+	if (result)
+	{
+		memcpy(result, data, length);
+		result[length] = 0;
+	}
+
+	return result;
+}
+
+// Secrets go out with write(2) rather than stdio, which would keep a copy of
+// them in its buffer until exit.
+bool write_all(int fd, const void * data, size_t length)
+{
+	const char * next = data;
+	ssize_t written;
+
+	while (length > 0)
+	{
+		if ((written = write(fd, next, length)) < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+		next += written;
+		length -= written;
+	}
+
+	return true;
+}
+
+// One "name=value\n" line of the credential protocol, in a single writev when
+// the descriptor takes it all.
+bool write_attribute(int fd, const char * name, const char * value)
+{
+	struct iovec parts[] = { { (void *)name, strlen(name) }, { "=", 1 }, { (void *)value, strlen(value) }, { "\n", 1 } };
+	size_t total = parts[0].iov_len + parts[2].iov_len + 2;
+	ssize_t written;
+
+	while ((written = writev(fd, parts, 4)) < 0 && errno == EINTR)
+		;
+	if (written < 0)
+		return false;
+	if ((size_t)written == total)
+		return true;
+
+	// A short write; finish the line piece by piece from where it stopped.
+	for (int i = 0; i < 4; i++)
+	{
+		if ((size_t)written >= parts[i].iov_len)
+		{
+			written -= parts[i].iov_len;
+			continue;
+		}
+		if (!write_all(fd, (char *)parts[i].iov_base + written, parts[i].iov_len - written))
+			return false;
+		written = 0;
+	}
+
+	return true;
+}
@@ -0,0 +1,143 @@
+//
+//  warm.c
+//  git-password
+//
+//  Copyright (C) 2011 by Samuel Kadolph
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "git_password.h"
+
+struct WarmList
+{
+	char ** repositories;
+	size_t count;
+	size_t capacity;
+};
+typedef struct WarmList WarmList;
+
+static void warm_add(WarmList * list, const char * url, FILE * terminal)
+{
+	if (list->count == list->capacity)
+	{
+		list->capacity = list->capacity ? list->capacity * 2 : 64;
+		if ((list->repositories = realloc(list->repositories, list->capacity * sizeof(char *))) == NULL)
+			fatal("unable to allocate memory", terminal);
+	}
+
+	list->repositories[list->count++] = canonical_repository(url, terminal);
+}
+
+// One url per line; blank lines and lines starting with # are skipped.
+static void warm_add_file(WarmList * list, const char * path, FILE * terminal)
+{
+	FILE * input = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	char * line = NULL, * url;
+	size_t capacity = 0;
+
+	if (!input)
+		fatal("unable to open url list", terminal);
+
+	while (getline(&line, &capacity, input) > 0)
+	{
+		for (url = trim_trailing_whitespace(line); *url == ' ' || *url == '\t'; url++)
+			;
+		if (*url && *url != '#')
+			warm_add(list, url, terminal);
+	}
+
+	free(line);
+	if (input != stdin)
+		fclose(input);
+}
+
+static int compare_repositories(const void * left, const void * right)
+{
+	return strcmp(*(char * const *)left, *(char * const *)right);
+}
+
+// git-password warm [--ttl <seconds>] [--from-file <path>] <url>...: resolve every
+// repository once in this process, which opens the keychain a single time, and
+// hand the results to the daemon so the jobs that follow never reach securityd.
+void run_warm(int argc, const char * argv[], FILE * terminal)
+{
+	WarmList list = { NULL, 0, 0 };
+	KeyChainItem ** items;
+	Backend * source;
+	double started;
+	size_t unique = 0, missing = 0;
+	int ttl = 0, stored;
+
+	for (int i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--ttl") == 0 && i + 1 < argc)
+		{
+			if ((ttl = atoi(argv[++i])) <= 0)
+				fatal("cache ttl must be positive", terminal);
+		}
+		else if (strcmp(argv[i], "--from-file") == 0 && i + 1 < argc)
+			warm_add_file(&list, argv[++i], terminal);
+		else if (argv[i][0] == '-')
+			fatal("usage: git-password warm [--ttl <seconds>] [--from-file <path>] <url>...", terminal);
+		else
+			warm_add(&list, argv[i], terminal);
+	}
+	if (list.count == 0)
+		fatal("usage: git-password warm [--ttl <seconds>] [--from-file <path>] <url>...", terminal);
+
+	// Many urls share a repository once canonicalised; each is resolved once.
+	qsort(list.repositories, list.count, sizeof(char *), compare_repositories);
+	for (size_t i = 0; i < list.count; i++)
+		if (unique == 0 || strcmp(list.repositories[unique - 1], list.repositories[i]) != 0)
+			list.repositories[unique++] = list.repositories[i];
+
+	if ((items = calloc(unique, sizeof(KeyChainItem *))) == NULL)
+		fatal("unable to allocate memory", terminal);
+
+	started = trace_enter("warm");
+	source = source_backend(terminal);
+	for (size_t i = 0; i < unique; i++)
+	{
+		OSStatus status = source->lookup(source, list.repositories[i], true, &items[i], terminal);
+
+		if (status == errSecItemNotFound)
+		{
+			fprintf(terminal, "warning: no credentials for %s\n", list.repositories[i]);
+			missing++;
+		}
+		else if (status != errSecSuccess)
+			security(status, terminal);
+	}
+	trace_leave("warm", started);
+
+	if ((stored = daemon_warm(list.repositories, items, unique, ttl, terminal)) < 0)
+		fatal("daemon is not running", terminal);
+
+	for (size_t i = 0; i < unique; i++)
+		free_keychain_item(items[i]);
+	free(items);
+	free(list.repositories);
+
+	if (missing)
+		fatal(arena_printf(terminal, "%zu of %zu repositories have no credentials", missing, unique), terminal);
+	fprintf(terminal, "warmed %d repositories\n", stored);
+}